@@ -0,0 +1,71 @@
+#!/bin/bash
+# enginebench.sh : compare I/O engines of the server under the same load from the stress client.
+#
+# build commands in UNIX-like environment, run from this directory:
+# g++ ../TcpServer/*.cpp -std=c++14 -O2 -pthread -o server
+# g++ ../TcpClient/client.cpp -std=c++11 -O2 -pthread -o client
+# usage: enginebench.sh [number of clients] [client threads] [runs] [seconds] [server cpus] [client cpus]
+# every client sends login requests in a loop, so each engine sees the same message mix.
+# server and client are pinned to separate cpu sets with taskset, so they do not compete for a core,
+# every engine is run several times and median, min and max of messages per second are reported.
+# engines are taken from ENGINES, e.g. ENGINES="epoll select uring reuseport" (default)
+
+clients=${1:-100}
+threads=${2:-2}
+runs=${3:-5}
+seconds=${4:-10}
+serverCpus=${5:-0}
+clientCpus=${6:-1}
+engines=${ENGINES:-"epoll select uring reuseport"}
+
+server=${SERVER:-./server}
+client=${CLIENT:-./client}
+
+# windows printed while clients connect and while they stop are left out
+warmup=3
+
+if [ ! -x "$server" ] || [ ! -x "$client" ]; then
+	echo "build $server and $client first, see top of this script"
+	exit 1
+fi
+
+if [ "$serverCpus" = "$clientCpus" ]; then
+	echo "warning: server and client share cpus $serverCpus, results compare engines under contention only"
+fi
+
+# messages per second of one run, averaged over windows after warmup
+runOnce() {
+	local log
+	log=$(mktemp)
+
+	(sleep $((seconds + warmup + 2)); echo exit) | timeout $((seconds + warmup + 6)) taskset -c "$serverCpus" "$server" "$@" > "$log" 2>&1 &
+	sleep 0.5
+	(sleep $((seconds + warmup)); echo exit) | timeout $((seconds + warmup + 2)) taskset -c "$clientCpus" "$client" "$clients" "$threads" > /dev/null 2>&1
+	wait 2>/dev/null
+
+	grep -o "receive [0-9]* packets, [0-9]* messages" "$log" | tail -n +$((warmup + 1)) | head -n "$seconds" |
+		awk '{ m += $4; n++ } END { if (n > 0) printf "%d\n", m / n; else print 0 }'
+
+	rm -f "$log"
+
+	# listening port is released before next run
+	sleep 1
+}
+
+echo "| engine | median msg/s | min | max |"
+echo "|:-------|-------------:|----:|----:|"
+
+for engine in $engines; do
+	results=()
+
+	for ((n = 0; n < runs; n++)); do
+		results+=($(runOnce $engine))
+	done
+
+	printf "%s\n" "${results[@]}" | sort -n | awk -v engine="$engine" '
+		{ v[NR] = $1 }
+		END {
+			median = NR % 2 ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2
+			printf "| %s | %d | %d | %d |\n", engine, median, v[1], v[NR]
+		}'
+done
@@ -0,0 +1,232 @@
+// membench.cpp : multithreaded alloc/free benchmark of the server's memory manager.
+//
+
+// compile command in UNIX-like environment:
+// g++ membench.cpp ../TcpServer/MemoryMgr.cpp -std=c++14 -O2 -pthread -o membench
+// usage: membench [number of threads] [operations per thread]
+// sizes are random for memory manager and malloc, object pool serves objects of the size of a client
+
+#include "../TcpServer/MemoryMgr.hpp"
+#include "../TcpServer/ObjectPool.hpp"
+#include "../TcpServer/CELLQueue.hpp"
+#include "../TcpServer/CELLTimestamp.hpp"
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include <random>
+
+// number of threads
+int tCount = 4;
+
+// alloc/free pairs done by each thread
+int opCount = 2000000;
+
+// blocks each thread keeps alive in local test
+#define LIVE_BLOCKS 64
+
+// allocator under test, memory manager is used without global operator new so the
+// benchmark itself runs on malloc
+struct Allocator {
+	const char* name;
+	void* (*alloc)(size_t nSize);
+	void (*release)(void* p);
+	// thread caches of memory manager
+	bool bCache;
+};
+
+void* mallocAlloc(size_t nSize) {
+	return malloc(nSize);
+}
+
+void mallocFree(void* p) {
+	free(p);
+}
+
+void* poolAlloc(size_t nSize) {
+	return MemoryMgr::getInstance().allocMem(nSize);
+}
+
+void poolFree(void* p) {
+	MemoryMgr::getInstance().freeMem(p);
+}
+
+// object as large as a client, from a pool as large as the one of clients
+class BenchObject : public ObjectPoolBase<BenchObject, 10000> {
+	char data[160];
+};
+
+void* objectAlloc(size_t nSize) {
+	return new BenchObject();
+}
+
+void objectFree(void* p) {
+	delete (BenchObject*)p;
+}
+
+Allocator allocators[] = {
+	{ "malloc", mallocAlloc, mallocFree, false },
+	{ "pool (locked)", poolAlloc, poolFree, false },
+	{ "pool (thread cache)", poolAlloc, poolFree, true },
+	{ "object pool", objectAlloc, objectFree, true }
+};
+
+// sizes of messages and small objects, up to largest pool block by default
+std::vector<size_t> randomSizes(int seed, size_t maxSize = MAX_MEMORY_SIZE) {
+	std::minstd_rand random(seed);
+	std::vector<size_t> sizes(4096);
+
+	for (auto& size : sizes) {
+		size = 16 + random() % (maxSize - 16);
+	}
+
+	return sizes;
+}
+
+// every thread frees its own blocks, a window of live blocks is replaced one by one
+void localThread(Allocator* pAlloc, int id) {
+	std::vector<size_t> sizes = randomSizes(id + 1);
+	void* blocks[LIVE_BLOCKS];
+
+	for (int n = 0; n < LIVE_BLOCKS; n++) {
+		blocks[n] = pAlloc->alloc(sizes[n]);
+	}
+
+	for (int n = 0; n < opCount; n++) {
+		int slot = n % LIVE_BLOCKS;
+		pAlloc->release(blocks[slot]);
+		blocks[slot] = pAlloc->alloc(sizes[n % sizes.size()]);
+		// touch block like a message would be written
+		*(char*)blocks[slot] = (char)n;
+	}
+
+	for (int n = 0; n < LIVE_BLOCKS; n++) {
+		pAlloc->release(blocks[n]);
+	}
+}
+
+// threads work in pairs, one requests blocks and hands them over to the other which frees them,
+// like messages received on a child server and handled by its task thread
+void producerThread(Allocator* pAlloc, CellMpscQueue<void*>* pQueue, int id) {
+	std::vector<size_t> sizes = randomSizes(id + 1);
+
+	for (int n = 0; n < opCount; n++) {
+		void* p = pAlloc->alloc(sizes[n % sizes.size()]);
+		*(char*)p = (char)n;
+
+		while (!pQueue->push(std::move(p))) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void consumerThread(Allocator* pAlloc, CellMpscQueue<void*>* pQueue) {
+	void* p = nullptr;
+
+	for (int n = 0; n < opCount; ) {
+		if (!pQueue->pop(p)) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		pAlloc->release(p);
+		n++;
+	}
+}
+
+// memory taken from pools for blocks which are all alive, compared to the bytes requested,
+// block headers and rounding up to a size class make up the difference
+void runFootprint(int nBlocks, size_t maxSize) {
+	std::vector<size_t> sizes = randomSizes(0, maxSize);
+	std::vector<void*> blocks;
+	size_t requested = 0;
+
+	MemoryStats before = MemoryMgr::getInstance().getStats();
+
+	for (int n = 0; n < nBlocks; n++) {
+		size_t size = sizes[n % sizes.size()];
+		blocks.push_back(poolAlloc(size));
+		requested += size;
+	}
+
+	MemoryStats after = MemoryMgr::getInstance().getStats();
+
+	size_t used = 0;
+	for (size_t i = 0; i < sizeof(after.pools) / sizeof(after.pools[0]); i++) {
+		used += (after.pools[i].nLive - before.pools[i].nLive) * (after.pools[i].nSize + sizeof(MemoryBlock));
+	}
+
+	printf("footprint of %d live blocks of 16-%d bytes: %.1f MB requested, %.1f MB of pool blocks, %.1f%% overhead\n",
+		nBlocks, (int)maxSize, requested / 1048576.0, used / 1048576.0, (used - requested) * 100.0 / requested);
+
+	for (auto p : blocks) {
+		poolFree(p);
+	}
+}
+
+// return wall time per alloc/free pair of all threads in nanoseconds
+double runLocal(Allocator* pAlloc) {
+	std::vector<std::thread> threads;
+	CELLTimestamp time;
+
+	for (int n = 0; n < tCount; n++) {
+		threads.emplace_back(localThread, pAlloc, n);
+	}
+
+	for (auto& t : threads) t.join();
+
+	return time.getElapsedTimeInMicroSec() * 1000.0 / ((double)opCount * tCount);
+}
+
+// return wall time per alloc/free pair of all pairs in nanoseconds
+double runCross(Allocator* pAlloc) {
+	int nPairs = tCount / 2 > 0 ? tCount / 2 : 1;
+
+	std::vector<std::unique_ptr<CellMpscQueue<void*>>> queues;
+	std::vector<std::thread> threads;
+
+	for (int n = 0; n < nPairs; n++) {
+		queues.emplace_back(new CellMpscQueue<void*>(4096));
+	}
+
+	CELLTimestamp time;
+
+	for (int n = 0; n < nPairs; n++) {
+		threads.emplace_back(producerThread, pAlloc, queues[n].get(), n);
+		threads.emplace_back(consumerThread, pAlloc, queues[n].get());
+	}
+
+	for (auto& t : threads) t.join();
+
+	return time.getElapsedTimeInMicroSec() * 1000.0 / ((double)opCount * nPairs);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc > 1) tCount = atoi(argv[1]);
+	if (argc > 2) opCount = atoi(argv[2]);
+	if (tCount < 1) tCount = 1;
+	if (opCount < 1) opCount = 1;
+
+	// pools are set up on first request, which should not be timed
+	MemoryMgr::getInstance().setThreadCache(false);
+	for (size_t size = 16; size <= MAX_MEMORY_SIZE; size *= 2) {
+		poolFree(poolAlloc(size));
+	}
+
+	runFootprint(100000, 256);
+	runFootprint(100000, MAX_MEMORY_SIZE);
+
+	printf("threads: %d, alloc/free pairs per thread: %d, sizes 16-%d bytes\n", tCount, opCount, MAX_MEMORY_SIZE);
+
+	for (auto& alloc : allocators) {
+		// caches only apply to threads created after the switch, every run starts new threads
+		MemoryMgr::getInstance().setThreadCache(alloc.bCache);
+
+		double local = runLocal(&alloc);
+		double cross = runCross(&alloc);
+
+		printf("%-20s local: %7.1f ns/op %7.2f Mops/s   cross-thread: %7.1f ns/op %7.2f Mops/s\n",
+			alloc.name, local, 1000.0 / local, cross, 1000.0 / cross);
+	}
+
+	return 0;
+}
@@ -3,6 +3,7 @@
 
 // compile command in UNIX-like environment:
 // g++ client.cpp -std=c++11 -pthread -o client
+// usage: client [number of clients] [number of threads]
 
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #define _CRT_SECURE_NO_WARNINGS
@@ -12,16 +13,16 @@
 #include <atomic>
 
 // number of threads
-const int tCount = 4;
+int tCount = 4;
 
 // total number of clients 
-const int cCount = 10000;
+int cCount = 10000;
 
 // clients array, it needs to be global so that each client in child thread can access it
-EasyTcpClient* clients[cCount];
+std::vector<EasyTcpClient*> clients;
 
-std::atomic_int sendCount = 0;
-std::atomic_int readyCount = 0;
+std::atomic_int sendCount{ 0 };
+std::atomic_int readyCount{ 0 };
 
 void childThread(int id) {
 	if (!isRun) return;
@@ -71,8 +72,12 @@ void childThread(int id) {
 	}
 }
 
-int main()
+int main(int argc, char** argv)
 {	
+	if (argc > 1) cCount = atoi(argv[1]);
+	if (argc > 2) tCount = atoi(argv[2]);
+	clients.resize(cCount);
+
 	// UI thread: create an thread for reading client input
 	std::thread clientCmdThread(cmdThread);
 
@@ -97,7 +102,7 @@ int main()
 			timer.update();
 		}
 
-		Sleep(1);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
 	}
 
 	//std::cout << count << std::endl;
@@ -5,7 +5,7 @@ void* operator new(size_t size) {
 	return MemoryMgr::getInstance().allocMem(size);
 }
 
-void operator delete(void* p) {
+void operator delete(void* p) noexcept {
 	MemoryMgr::getInstance().freeMem(p);
 }
 
@@ -13,7 +13,7 @@ void* operator new[](size_t size) {
 	return MemoryMgr::getInstance().allocMem(size);
 }
 
-void operator delete[](void* p) {
+void operator delete[](void* p) noexcept {
 	MemoryMgr::getInstance().freeMem(p);
 }
 
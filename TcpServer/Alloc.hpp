@@ -1,10 +1,12 @@
 #ifndef _MEMORY_ALLOC_H_
 #define _MEMORY_ALLOC_H_
 
+#include <stddef.h>
+
 void* operator new(size_t size);
 void* operator new[](size_t size);
-void operator delete(void* p);
-void operator delete[](void* p);
+void operator delete(void* p) noexcept;
+void operator delete[](void* p) noexcept;
 void* mem_alloc(size_t size);
 void mem_free(void* p);
 
@@ -0,0 +1,80 @@
+#include "CELLAffinity.hpp"
+
+#include <fstream>
+#include <stdlib.h>
+
+#ifdef __linux__
+#	include <pthread.h>
+#	include <sched.h>
+#endif
+
+// bind calling thread to one cpu, return false when cpu does not exist or platform cannot do it
+bool CellAffinity::pinThread(int cpu) {
+	if (cpu < 0) return false;
+
+#	ifdef _WIN32
+	if (cpu >= (int)(sizeof(DWORD_PTR) * 8)) return false;
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#	elif defined(__linux__)
+	if (cpu >= CPU_SETSIZE) return false;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#	else
+	return false;
+#	endif
+}
+
+// cpus of a numa node, empty when node is unknown
+std::vector<int> CellAffinity::getNodeCpus(int node) {
+	if (node < 0) return std::vector<int>();
+
+	std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+	std::string list;
+
+	if (!std::getline(file, list)) return std::vector<int>();
+	return parseCpuList(list.c_str());
+}
+
+// numa node the network interface is attached to, -1 when unknown (or on a single node host)
+int CellAffinity::getNicNode(const char* ifname) {
+	std::ifstream file(std::string("/sys/class/net/") + ifname + "/device/numa_node");
+	int node = -1;
+
+	if (!(file >> node)) return -1;
+	return node;
+}
+
+// parse list such as "0-3,8,10-11" used by linux sysfs and by command line
+std::vector<int> CellAffinity::parseCpuList(const char* list) {
+	std::vector<int> cpus;
+	const char* p = list;
+
+	while (*p) {
+		char* end = nullptr;
+		long first = strtol(p, &end, 10);
+
+		// not a number, list ends here
+		if (end == p) break;
+
+		long last = first;
+		p = end;
+
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			if (end == p + 1) break;
+			p = end;
+		}
+
+		for (long cpu = first; cpu <= last; cpu++) {
+			cpus.push_back((int)cpu);
+		}
+
+		if (*p != ',') break;
+		p++;
+	}
+
+	return cpus;
+}
@@ -0,0 +1,26 @@
+#ifndef _CELL_AFFINITY_HPP_
+#define _CELL_AFFINITY_HPP_
+
+#include "Cell.hpp"
+
+#include <vector>
+#include <string>
+
+// placement of server threads on cpu cores. memory is placed by first touch on linux and windows,
+// so a thread pinned before it allocates and fills its buffers gets them from its local numa node
+class CellAffinity {
+public:
+	// bind calling thread to one cpu, return false when cpu does not exist or platform cannot do it
+	static bool pinThread(int cpu);
+
+	// cpus of a numa node, empty when node is unknown
+	static std::vector<int> getNodeCpus(int node);
+
+	// numa node the network interface is attached to, -1 when unknown (or on a single node host)
+	static int getNicNode(const char* ifname);
+
+	// parse list such as "0-3,8,10-11" used by linux sysfs and by command line
+	static std::vector<int> parseCpuList(const char* list);
+};
+
+#endif // !_CELL_AFFINITY_HPP_
@@ -0,0 +1,138 @@
+#include "CELLBalancer.hpp"
+
+CellBalancer::CellBalancer() :_loads{} {}
+
+// index of child server which takes next client
+size_t CellBalancer::pick(std::vector<ChildServerPtr>& children) {
+	if (_loads.size() != children.size()) _loads.resize(children.size());
+
+	size_t n = choose(children);
+	_loads[n].assigned++;
+	return n;
+}
+
+// measure load of children over the time since last call, called about once a second
+void CellBalancer::sample(std::vector<ChildServerPtr>& children, double seconds) {
+	if (_loads.size() != children.size()) _loads.resize(children.size());
+	if (seconds <= 0) return;
+
+	for (size_t n = 0; n < children.size(); n++) {
+		CellChildLoad& load = _loads[n];
+		long long bytes = children[n]->getRecvBytes();
+		long long msgs = children[n]->getRecvMsgs();
+
+		load.clients = children[n]->getCount();
+		load.bytesPerSec = (bytes - load.lastBytes) / seconds;
+		load.msgsPerSec = (msgs - load.lastMsgs) / seconds;
+		load.lastBytes = bytes;
+		load.lastMsgs = msgs;
+		load.assigned = 0;
+	}
+}
+
+// load measured by last sample()
+const std::vector<CellChildLoad>& CellBalancer::getLoads() {
+	return _loads;
+}
+
+CellBalancer::~CellBalancer() = default;
+
+// create balancer of given type
+std::unique_ptr<CellBalancer> CellBalancer::create(CellBalancerType type) {
+	switch (type) {
+		case CellBalancerType::RoundRobin:
+			return std::unique_ptr<CellBalancer>(new CellRoundRobinBalancer());
+		case CellBalancerType::PowerOfTwo:
+			return std::unique_ptr<CellBalancer>(new CellPowerOfTwoBalancer());
+		case CellBalancerType::LeastBytes:
+			return std::unique_ptr<CellBalancer>(new CellLeastTrafficBalancer(true));
+		case CellBalancerType::LeastMessages:
+			return std::unique_ptr<CellBalancer>(new CellLeastTrafficBalancer(false));
+		default:
+			return std::unique_ptr<CellBalancer>(new CellLeastConnBalancer());
+	}
+}
+
+CellRoundRobinBalancer::CellRoundRobinBalancer() :_next{ 0 } {}
+
+size_t CellRoundRobinBalancer::choose(std::vector<ChildServerPtr>& children) {
+	return _next++ % children.size();
+}
+
+const char* CellRoundRobinBalancer::name() const {
+	return "round-robin";
+}
+
+CellPowerOfTwoBalancer::CellPowerOfTwoBalancer() :_random{ std::random_device{}() } {}
+
+size_t CellPowerOfTwoBalancer::choose(std::vector<ChildServerPtr>& children) {
+	if (children.size() < 2) return 0;
+
+	// second candidate is drawn from the other children, so two different ones are compared
+	size_t a = _random() % children.size();
+	size_t b = (a + 1 + _random() % (children.size() - 1)) % children.size();
+
+	return children[b]->getCount() < children[a]->getCount() ? b : a;
+}
+
+const char* CellPowerOfTwoBalancer::name() const {
+	return "power-of-two";
+}
+
+CellLeastConnBalancer::CellLeastConnBalancer() = default;
+
+size_t CellLeastConnBalancer::choose(std::vector<ChildServerPtr>& children) {
+	size_t minIndex = 0;
+	size_t minCount = children[0]->getCount();
+
+	for (size_t n = 1; n < children.size(); n++) {
+		size_t count = children[n]->getCount();
+
+		if (count < minCount) {
+			minIndex = n;
+			minCount = count;
+		}
+	}
+
+	return minIndex;
+}
+
+const char* CellLeastConnBalancer::name() const {
+	return "least-connections";
+}
+
+CellLeastTrafficBalancer::CellLeastTrafficBalancer(bool byBytes) :_byBytes{ byBytes } {}
+
+size_t CellLeastTrafficBalancer::choose(std::vector<ChildServerPtr>& children) {
+	double total = 0;
+	size_t nClients = 0;
+
+	for (auto& load : _loads) {
+		total += _byBytes ? load.bytesPerSec : load.msgsPerSec;
+		nClients += load.clients;
+	}
+
+	// clients assigned in current window are counted with average traffic of a client,
+	// otherwise all of them would go to the same child until next sample
+	double perClient = nClients > 0 && total > 0 ? total / nClients : 1;
+
+	size_t minIndex = 0;
+	double minLoad = 0;
+
+	for (size_t n = 0; n < children.size(); n++) {
+		const CellChildLoad& load = _loads[n];
+		double traffic = (_byBytes ? load.bytesPerSec : load.msgsPerSec) + load.assigned * perClient;
+
+		// idle children are told apart by their number of clients
+		if (n == 0 || traffic < minLoad || (traffic == minLoad && children[n]->getCount() < children[minIndex]->getCount())) {
+			minIndex = n;
+			minLoad = traffic;
+		}
+	}
+
+	return minIndex;
+}
+
+const char* CellLeastTrafficBalancer::name() const {
+	return _byBytes ? "least-bytes" : "least-messages";
+}
@@ -0,0 +1,124 @@
+#ifndef _CELL_BALANCER_HPP_
+#define _CELL_BALANCER_HPP_
+
+#include "ChildServer.hpp"
+
+#include <vector>
+#include <memory>
+#include <random>
+
+// strategies which can be chosen when launching the server
+enum class CellBalancerType {
+	// children take turns, ignores load
+	RoundRobin,
+	// fewer clients of two children chosen at random
+	PowerOfTwo,
+	// fewest clients of all children
+	LeastConnections,
+	// fewest bytes received in last stats window
+	LeastBytes,
+	// fewest messages received in last stats window
+	LeastMessages
+};
+
+// load of one child server, rates are measured over last stats window
+struct CellChildLoad {
+	size_t clients = 0;
+
+	double bytesPerSec = 0;
+	double msgsPerSec = 0;
+
+	// totals of child server when window started
+	long long lastBytes = 0;
+	long long lastMsgs = 0;
+
+	// clients assigned since window started, their traffic is not part of rates yet
+	size_t assigned = 0;
+};
+
+// chooses the child server a new connection is handed to, only used by main thread
+class CellBalancer {
+public:
+	CellBalancer();
+
+	CellBalancer(const CellBalancer&) = delete;
+	void operator=(const CellBalancer&) = delete;
+
+	// index of child server which takes next client
+	size_t pick(std::vector<ChildServerPtr>& children);
+
+	// measure load of children over the time since last call, called about once a second
+	void sample(std::vector<ChildServerPtr>& children, double seconds);
+
+	// load measured by last sample()
+	const std::vector<CellChildLoad>& getLoads();
+
+	virtual const char* name() const = 0;
+
+	virtual ~CellBalancer();
+
+	// create balancer of given type
+	static std::unique_ptr<CellBalancer> create(CellBalancerType type);
+
+protected:
+	// strategy itself, _loads has one entry for every child when it is called
+	virtual size_t choose(std::vector<ChildServerPtr>& children) = 0;
+
+	std::vector<CellChildLoad> _loads;
+};
+
+class CellRoundRobinBalancer : public CellBalancer {
+public:
+	CellRoundRobinBalancer();
+
+	virtual const char* name() const override;
+
+protected:
+	virtual size_t choose(std::vector<ChildServerPtr>& children) override;
+
+private:
+	size_t _next;
+};
+
+// two random candidates avoid scanning all children, and unlike a single random choice
+// keep the most loaded child far below the maximum
+class CellPowerOfTwoBalancer : public CellBalancer {
+public:
+	CellPowerOfTwoBalancer();
+
+	virtual const char* name() const override;
+
+protected:
+	virtual size_t choose(std::vector<ChildServerPtr>& children) override;
+
+private:
+	std::minstd_rand _random;
+};
+
+class CellLeastConnBalancer : public CellBalancer {
+public:
+	CellLeastConnBalancer();
+
+	virtual const char* name() const override;
+
+protected:
+	virtual size_t choose(std::vector<ChildServerPtr>& children) override;
+};
+
+// least traffic in bytes or messages, a few chatty clients then count more than many idle ones
+class CellLeastTrafficBalancer : public CellBalancer {
+public:
+	explicit CellLeastTrafficBalancer(bool byBytes);
+
+	virtual const char* name() const override;
+
+protected:
+	virtual size_t choose(std::vector<ChildServerPtr>& children) override;
+
+private:
+	bool _byBytes;
+};
+
+using CellBalancerPtr = std::unique_ptr<CellBalancer>;
+
+#endif // !_CELL_BALANCER_HPP_
@@ -0,0 +1,288 @@
+#include "CELLBuffer.hpp"
+
+#include <stdlib.h>
+
+#ifndef _WIN32
+#	include <sys/uio.h>
+#endif
+
+CellBufferPool CellBufferPool::pool{};
+
+CellBufferPool::CellBufferPool() :_classes{}, _chunks{}, _chunksMutex{} {
+	size_t nSize = CELL_BUFFER_MIN_SIZE;
+
+	for (auto& sizeClass : _classes) {
+		sizeClass.nSize = nSize;
+		nSize *= 4;
+	}
+}
+
+CellBufferPool& CellBufferPool::getInstance() {
+	return pool;
+}
+
+// smallest class size which can hold nSize bytes, 0 when nSize is larger than all classes
+size_t CellBufferPool::classSize(size_t nSize) {
+	size_t size = CELL_BUFFER_MIN_SIZE;
+
+	for (int n = 0; n < CELL_BUFFER_CLASSES; n++) {
+		if (nSize <= size) return size;
+		size *= 4;
+	}
+
+	return 0;
+}
+
+// get a buffer of class size nSize
+char* CellBufferPool::allocBuf(size_t nSize) {
+	for (auto& sizeClass : _classes) {
+		if (sizeClass.nSize != nSize) continue;
+
+		std::lock_guard<std::mutex> lock(sizeClass.mutex);
+
+		if (sizeClass.freeList.empty()) {
+			// carve a new chunk into buffers of this class, large classes get at least one buffer
+			size_t chunkSize = nSize > CELL_BUFFER_CHUNK_SIZE ? nSize : CELL_BUFFER_CHUNK_SIZE;
+			char* pChunk = (char*)malloc(chunkSize);
+			if (!pChunk) return nullptr;
+
+			{
+				std::lock_guard<std::mutex> chunksLock(_chunksMutex);
+				_chunks.push_back(pChunk);
+			}
+
+			for (size_t offset = 0; offset + nSize <= chunkSize; offset += nSize) {
+				sizeClass.freeList.push_back(pChunk + offset);
+			}
+		}
+
+		char* pBuf = sizeClass.freeList.back();
+		sizeClass.freeList.pop_back();
+		return pBuf;
+	}
+
+	return nullptr;
+}
+
+// return a buffer of class size nSize
+void CellBufferPool::freeBuf(char* pBuf, size_t nSize) {
+	for (auto& sizeClass : _classes) {
+		if (sizeClass.nSize != nSize) continue;
+
+		std::lock_guard<std::mutex> lock(sizeClass.mutex);
+		sizeClass.freeList.push_back(pBuf);
+		return;
+	}
+}
+
+CellBufferPool::~CellBufferPool() {
+	for (auto pChunk : _chunks) {
+		free(pChunk);
+	}
+}
+
+CellRingBuffer::CellRingBuffer(size_t maxSize) :_pBuf{ nullptr }, _capacity{ 0 }, _maxSize{ maxSize }, _head{ 0 }, _size{ 0 } {}
+
+size_t CellRingBuffer::size() const {
+	return _size;
+}
+
+size_t CellRingBuffer::capacity() const {
+	return _capacity;
+}
+
+// make sure n more bytes can be written, move to a larger size class if needed,
+// return false when buffer would exceed its max size
+bool CellRingBuffer::reserve(size_t n) {
+	if (_size + n <= _capacity) return true;
+	if (_size + n > _maxSize) return false;
+
+	size_t nSize = CellBufferPool::classSize(_size + n);
+	if (nSize == 0) return false;
+
+	char* pBuf = CellBufferPool::getInstance().allocBuf(nSize);
+	if (!pBuf) return false;
+
+	// connection streams large messages, keep its data in a larger buffer from now on
+	if (_pBuf) {
+		copyOut(pBuf, _size);
+		CellBufferPool::getInstance().freeBuf(_pBuf, _capacity);
+	}
+
+	_pBuf = pBuf;
+	_capacity = nSize;
+	_head = 0;
+	return true;
+}
+
+// append data, return false when buffer would exceed its max size
+bool CellRingBuffer::write(const char* pData, size_t nLen) {
+	if (nLen == 0) return true;
+	if (!reserve(nLen)) return false;
+
+	size_t tail = (_head + _size) % _capacity;
+	size_t len1 = _capacity - tail < nLen ? _capacity - tail : nLen;
+
+	memcpy(_pBuf + tail, pData, len1);
+	memcpy(_pBuf, pData + len1, nLen - len1);
+
+	_size += nLen;
+	return true;
+}
+
+// contiguous data at read position, nLen is smaller than size() when data wraps around the end of buffer
+const char* CellRingBuffer::front(size_t& nLen) const {
+	nLen = _capacity - _head < _size ? _capacity - _head : _size;
+	return _pBuf + _head;
+}
+
+// copy n bytes at read position without consuming them
+void CellRingBuffer::copyOut(void* pDst, size_t n) const {
+	size_t len1 = _capacity - _head < n ? _capacity - _head : n;
+
+	memcpy(pDst, _pBuf + _head, len1);
+	memcpy((char*)pDst + len1, _pBuf, n - len1);
+}
+
+// return pointer to n contiguous bytes at read position, bytes are only copied (stitched)
+// into scratch when they wrap around the end of buffer
+const char* CellRingBuffer::peek(size_t n, char* scratch) const {
+	if (_head + n <= _capacity) return _pBuf + _head;
+
+	copyOut(scratch, n);
+	return scratch;
+}
+
+// move read position forward after data has been processed, buffer is released when it becomes empty
+void CellRingBuffer::consume(size_t n) {
+	_size -= n;
+
+	if (_size == 0) {
+		release();
+		return;
+	}
+
+	_head = (_head + n) % _capacity;
+}
+
+// give memory back to pool
+void CellRingBuffer::release() {
+	if (_pBuf) CellBufferPool::getInstance().freeBuf(_pBuf, _capacity);
+
+	_pBuf = nullptr;
+	_capacity = 0;
+	_head = 0;
+	_size = 0;
+}
+
+CellRingBuffer::~CellRingBuffer() {
+	release();
+}
+
+CellBufferChain::CellBufferChain() :_pFirst{ nullptr }, _pLast{ nullptr }, _size{ 0 } {}
+
+size_t CellBufferChain::size() const {
+	return _size;
+}
+
+// append data, a new block is taken from pool when the last one is full
+bool CellBufferChain::write(const char* pData, size_t nLen) {
+	while (nLen > 0) {
+		if (!_pLast || _pLast->tail == BLOCK_DATA_SIZE) {
+			Block* pBlock = (Block*)CellBufferPool::getInstance().allocBuf(CELL_BUFFER_BLOCK_SIZE);
+			if (!pBlock) return false;
+
+			pBlock->pNext = nullptr;
+			pBlock->head = 0;
+			pBlock->tail = 0;
+
+			if (_pLast) _pLast->pNext = pBlock;
+			else _pFirst = pBlock;
+			_pLast = pBlock;
+		}
+
+		size_t nCopy = BLOCK_DATA_SIZE - _pLast->tail < nLen ? BLOCK_DATA_SIZE - _pLast->tail : nLen;
+		memcpy(_pLast->data() + _pLast->tail, pData, nCopy);
+
+		_pLast->tail += nCopy;
+		_size += nCopy;
+		pData += nCopy;
+		nLen -= nCopy;
+	}
+
+	return true;
+}
+
+// contiguous data of the first block
+const char* CellBufferChain::front(size_t& nLen) const {
+	if (!_pFirst) {
+		nLen = 0;
+		return nullptr;
+	}
+
+	nLen = _pFirst->tail - _pFirst->head;
+	return _pFirst->data() + _pFirst->head;
+}
+
+// send data of several blocks with one system call, sent data is consumed
+int CellBufferChain::sendTo(SOCKET sock) {
+	if (_size == 0) return 0;
+
+#	ifdef _WIN32
+	WSABUF bufs[CELL_BUFFER_MAX_IOV];
+	DWORD nBufs = 0;
+
+	for (Block* pBlock = _pFirst; pBlock && nBufs < CELL_BUFFER_MAX_IOV; pBlock = pBlock->pNext) {
+		bufs[nBufs].buf = pBlock->data() + pBlock->head;
+		bufs[nBufs].len = (ULONG)(pBlock->tail - pBlock->head);
+		nBufs++;
+	}
+
+	DWORD nSent = 0;
+	if (WSASend(sock, bufs, nBufs, &nSent, 0, nullptr, nullptr) == SOCKET_ERROR) return SOCKET_ERROR;
+	int nLen = (int)nSent;
+#	else
+	iovec iov[CELL_BUFFER_MAX_IOV];
+	int nIov = 0;
+
+	for (Block* pBlock = _pFirst; pBlock && nIov < CELL_BUFFER_MAX_IOV; pBlock = pBlock->pNext) {
+		iov[nIov].iov_base = pBlock->data() + pBlock->head;
+		iov[nIov].iov_len = pBlock->tail - pBlock->head;
+		nIov++;
+	}
+
+	int nLen = (int)writev(sock, iov, nIov);
+#	endif
+
+	if (nLen > 0) consume(nLen);
+	return nLen;
+}
+
+// remove n bytes from front, drained blocks go back to pool
+void CellBufferChain::consume(size_t n) {
+	_size -= n;
+
+	while (n > 0) {
+		size_t nUsed = _pFirst->tail - _pFirst->head < n ? _pFirst->tail - _pFirst->head : n;
+		_pFirst->head += nUsed;
+		n -= nUsed;
+
+		// keep the last block for following writes unless queue becomes empty
+		if (_pFirst->head == _pFirst->tail && (_pFirst != _pLast || _size == 0)) {
+			Block* pBlock = _pFirst;
+			_pFirst = pBlock->pNext;
+			if (!_pFirst) _pLast = nullptr;
+
+			CellBufferPool::getInstance().freeBuf((char*)pBlock, CELL_BUFFER_BLOCK_SIZE);
+		}
+	}
+}
+
+CellBufferChain::~CellBufferChain() {
+	while (_pFirst) {
+		Block* pBlock = _pFirst;
+		_pFirst = pBlock->pNext;
+
+		CellBufferPool::getInstance().freeBuf((char*)pBlock, CELL_BUFFER_BLOCK_SIZE);
+	}
+}
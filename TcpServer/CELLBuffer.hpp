@@ -0,0 +1,174 @@
+#ifndef _CELL_BUFFER_HPP_
+#define _CELL_BUFFER_HPP_
+
+#include "Cell.hpp"
+
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+
+// number of buffer size classes, each class is 4 times larger than the previous one
+#define CELL_BUFFER_CLASSES 4
+
+// smallest buffer size class
+#define CELL_BUFFER_MIN_SIZE 1024
+
+// size of memory requested from heap when a size class runs out of buffers
+#define CELL_BUFFER_CHUNK_SIZE (256 * 1024)
+
+// size of each block of CellBufferChain, one of the size classes
+#define CELL_BUFFER_BLOCK_SIZE (16 * 1024)
+
+// maximum number of blocks sent with one system call
+#define CELL_BUFFER_MAX_IOV 16
+
+// slab of connection buffers shared by all threads, buffers are grouped into size classes
+// (1KB, 4KB, 16KB, 64KB) and kept in free lists after they are returned
+class CellBufferPool {
+public:
+	static CellBufferPool& getInstance();
+
+	// smallest class size which can hold nSize bytes, 0 when nSize is larger than all classes
+	static size_t classSize(size_t nSize);
+
+	// get a buffer of class size nSize
+	char* allocBuf(size_t nSize);
+
+	// return a buffer of class size nSize
+	void freeBuf(char* pBuf, size_t nSize);
+
+	CellBufferPool(const CellBufferPool&) = delete;
+	void operator=(const CellBufferPool&) = delete;
+
+private:
+	// avoid user access pool directly
+	static CellBufferPool pool;
+
+	CellBufferPool();
+
+	~CellBufferPool();
+
+	// free buffers of one size class
+	struct SizeClass {
+		size_t nSize;
+		std::vector<char*> freeList;
+		std::mutex mutex;
+	};
+
+	SizeClass _classes[CELL_BUFFER_CLASSES];
+
+	// memory requested from heap, released when program exits
+	std::vector<char*> _chunks;
+
+	std::mutex _chunksMutex;
+};
+
+// circular buffer of one connection. memory is taken from CellBufferPool only when there is data to
+// keep and returned as soon as all data is consumed, so an idle connection owns no buffer at all.
+// data is appended at write position and consumed from read position, so
+// processing a message never shifts the following messages
+class CellRingBuffer {
+public:
+	// buffer grows through size classes on demand, but never beyond maxSize
+	explicit CellRingBuffer(size_t maxSize);
+
+	// buffer owns its memory and should not be copied
+	CellRingBuffer(const CellRingBuffer&) = delete;
+	void operator=(const CellRingBuffer&) = delete;
+
+	// number of bytes which can be read
+	size_t size() const;
+
+	// size of buffer currently owned, 0 when buffer is released
+	size_t capacity() const;
+
+	// make sure n more bytes can be written, move to a larger size class if needed,
+	// return false when buffer would exceed its max size
+	bool reserve(size_t n);
+
+	// append data, return false when buffer would exceed its max size
+	bool write(const char* pData, size_t nLen);
+
+	// contiguous data at read position, nLen is smaller than size() when data wraps around the end of buffer
+	const char* front(size_t& nLen) const;
+
+	// copy n bytes at read position without consuming them
+	void copyOut(void* pDst, size_t n) const;
+
+	// return pointer to n contiguous bytes at read position, bytes are only copied (stitched)
+	// into scratch when they wrap around the end of buffer
+	const char* peek(size_t n, char* scratch) const;
+
+	// move read position forward after data has been processed, buffer is released when it becomes empty
+	void consume(size_t n);
+
+	~CellRingBuffer();
+
+private:
+	// give memory back to pool
+	void release();
+
+	char* _pBuf;
+
+	size_t _capacity;
+
+	size_t _maxSize;
+
+	// read position
+	size_t _head;
+
+	// number of bytes stored
+	size_t _size;
+};
+
+// queue of pooled blocks linked one after another, used for data waiting to be sent.
+// appending takes a new block instead of moving queued data, so the queue can grow up to the budget of
+// its owner and data handed to kernel stays in place
+class CellBufferChain {
+public:
+	CellBufferChain();
+
+	// chain owns its blocks and should not be copied
+	CellBufferChain(const CellBufferChain&) = delete;
+	void operator=(const CellBufferChain&) = delete;
+
+	// number of bytes queued
+	size_t size() const;
+
+	// append data, a new block is taken from pool when the last one is full
+	bool write(const char* pData, size_t nLen);
+
+	// contiguous data of the first block
+	const char* front(size_t& nLen) const;
+
+	// send data of several blocks with one system call, sent data is consumed
+	int sendTo(SOCKET sock);
+
+	// remove n bytes from front, drained blocks go back to pool
+	void consume(size_t n);
+
+	~CellBufferChain();
+
+private:
+	// header placed at the beginning of each pooled block, data follows it
+	struct Block {
+		Block* pNext;
+
+		// read and write position of data in this block
+		size_t head;
+		size_t tail;
+
+		char* data() { return (char*)(this + 1); }
+	};
+
+	// bytes of data one block can hold
+	static const size_t BLOCK_DATA_SIZE = CELL_BUFFER_BLOCK_SIZE - sizeof(Block);
+
+	Block* _pFirst;
+
+	Block* _pLast;
+
+	size_t _size;
+};
+
+#endif // !_CELL_BUFFER_HPP_
@@ -0,0 +1,79 @@
+#include "CELLClientRegistry.hpp"
+
+CellClientRegistry::CellClientRegistry() :_shards{}, _count{ 0 } {}
+
+// return false when id is already registered
+bool CellClientRegistry::insert(const ClientPtr& client) {
+	Shard& shard = shardOf(client->getId());
+
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	if (!shard.clients.emplace(client->getId(), client).second) return false;
+
+	_count++;
+	return true;
+}
+
+// return false when id is not registered
+bool CellClientRegistry::erase(unsigned long long id) {
+	Shard& shard = shardOf(id);
+	ClientPtr client;
+
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto iter = shard.clients.find(id);
+		if (iter == shard.clients.end()) return false;
+
+		// last reference may close the socket, which is done after unlocking
+		client = std::move(iter->second);
+		shard.clients.erase(iter);
+	}
+
+	_count--;
+	return true;
+}
+
+// nullptr when id is not registered
+ClientPtr CellClientRegistry::find(unsigned long long id) {
+	Shard& shard = shardOf(id);
+
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto iter = shard.clients.find(id);
+	return iter != shard.clients.end() ? iter->second : nullptr;
+}
+
+// number of connections, called by any thread
+size_t CellClientRegistry::size() const {
+	return _count;
+}
+
+// copy of all connections, shards are locked one at a time, so a connection which joins or exits
+// meanwhile may be missing or still be listed
+void CellClientRegistry::snapshot(std::vector<ClientPtr>& clients) {
+	clients.clear();
+	clients.reserve(_count);
+
+	for (auto& shard : _shards) {
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		for (auto& entry : shard.clients) {
+			clients.push_back(entry.second);
+		}
+	}
+}
+
+void CellClientRegistry::clear() {
+	for (auto& shard : _shards) {
+		std::unordered_map<unsigned long long, ClientPtr> clients;
+
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			clients.swap(shard.clients);
+			_count -= clients.size();
+		}
+	}
+}
+
+// ids are handed out one after another, so consecutive connections go to different shards
+CellClientRegistry::Shard& CellClientRegistry::shardOf(unsigned long long id) {
+	return _shards[id & (CELL_REGISTRY_SHARDS - 1)];
+}
@@ -0,0 +1,63 @@
+#ifndef _CELL_CLIENT_REGISTRY_HPP_
+#define _CELL_CLIENT_REGISTRY_HPP_
+
+#include "Client.hpp"
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+// number of shards of client registry, must be power of 2
+#ifndef CELL_REGISTRY_SHARDS
+#define CELL_REGISTRY_SHARDS 64
+#endif
+
+// all connections of server keyed by connection id, used by accept thread, child servers and console at the same time.
+// connections are spread over shards which are locked separately, so threads adding and removing different
+// connections rarely wait for each other, and each operation is one hash lookup
+class CellClientRegistry {
+public:
+	CellClientRegistry();
+
+	CellClientRegistry(const CellClientRegistry&) = delete;
+	void operator=(const CellClientRegistry&) = delete;
+
+	// return false when id is already registered
+	bool insert(const ClientPtr& client);
+
+	// return false when id is not registered
+	bool erase(unsigned long long id);
+
+	// nullptr when id is not registered
+	ClientPtr find(unsigned long long id);
+
+	// number of connections, called by any thread
+	size_t size() const;
+
+	// copy of all connections, shards are locked one at a time, so a connection which joins or exits
+	// meanwhile may be missing or still be listed
+	void snapshot(std::vector<ClientPtr>& clients);
+
+	void clear();
+
+private:
+	struct Shard {
+		std::mutex mutex;
+		std::unordered_map<unsigned long long, ClientPtr> clients;
+
+		// shards are locked by different threads, keep them on separate cache lines
+		char pad[64];
+	};
+
+	// ids are handed out one after another, so consecutive connections go to different shards
+	Shard& shardOf(unsigned long long id);
+
+	Shard _shards[CELL_REGISTRY_SHARDS];
+
+	std::atomic<size_t> _count;
+
+	static_assert((CELL_REGISTRY_SHARDS & (CELL_REGISTRY_SHARDS - 1)) == 0, "number of shards must be power of 2");
+};
+
+#endif // !_CELL_CLIENT_REGISTRY_HPP_
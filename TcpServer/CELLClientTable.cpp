@@ -0,0 +1,77 @@
+#include "CELLClientTable.hpp"
+
+CellClientTable::Slot::Slot(const ClientPtr& client) :sockfd{ client->getSockfd() }, waitingWrite{ false }, writeBlocked{ false },
+														readPaused{ false }, recvPending{ false }, recvMsgs{ 0 }, client{ client } {}
+
+CellClientTable::CellClientTable() :_index{}, _slots{} {}
+
+// nullptr when socket does not belong to a client of table
+CellClientTable::Slot* CellClientTable::find(SOCKET sockfd) {
+	size_t fd = (size_t)sockfd;
+	if (fd >= _index.size() || _index[fd] == 0) return nullptr;
+
+	return &_slots[_index[fd] - 1];
+}
+
+// replace client of the same socket if there is one, state of slot starts over
+CellClientTable::Slot& CellClientTable::insert(const ClientPtr& client) {
+	size_t fd = (size_t)client->getSockfd();
+
+	// grow with some room, so that sockets opened one after another do not resize index every time
+	if (fd >= _index.size()) _index.resize(fd + fd / 2 + 64, 0);
+
+	if (_index[fd] != 0) {
+		Slot& slot = _slots[_index[fd] - 1];
+		slot = Slot(client);
+		return slot;
+	}
+
+	_slots.push_back(Slot(client));
+	_index[fd] = (unsigned)_slots.size();
+	return _slots.back();
+}
+
+// return false when socket does not belong to a client of table
+bool CellClientTable::erase(SOCKET sockfd) {
+	size_t fd = (size_t)sockfd;
+	if (fd >= _index.size() || _index[fd] == 0) return false;
+
+	// last slot fills the hole, so slots stay dense
+	size_t pos = _index[fd] - 1;
+	if (pos != _slots.size() - 1) {
+		_slots[pos] = std::move(_slots.back());
+		_index[(size_t)_slots[pos].sockfd] = (unsigned)pos + 1;
+	}
+
+	_slots.pop_back();
+	_index[fd] = 0;
+	return true;
+}
+
+void CellClientTable::clear() {
+	for (auto& slot : _slots) {
+		_index[(size_t)slot.sockfd] = 0;
+	}
+	_slots.clear();
+}
+
+size_t CellClientTable::size() const {
+	return _slots.size();
+}
+
+bool CellClientTable::empty() const {
+	return _slots.empty();
+}
+
+// walk clients by position, removing a client moves the last one into its position
+CellClientTable::Slot& CellClientTable::at(size_t n) {
+	return _slots[n];
+}
+
+std::vector<CellClientTable::Slot>::iterator CellClientTable::begin() {
+	return _slots.begin();
+}
+
+std::vector<CellClientTable::Slot>::iterator CellClientTable::end() {
+	return _slots.end();
+}
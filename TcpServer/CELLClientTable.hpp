@@ -0,0 +1,69 @@
+#ifndef _CELL_CLIENT_TABLE_HPP_
+#define _CELL_CLIENT_TABLE_HPP_
+
+#include "Client.hpp"
+
+#include <vector>
+
+// clients of one thread kept in a dense array, a socket is mapped to its slot through an array indexed by socket,
+// so finding a client is one array access and walking all clients touches contiguous memory only.
+// slots are moved when a client is removed, references returned are valid until next insert() or erase()
+class CellClientTable {
+public:
+	// one connection, socket and state of event loop are stored next to client,
+	// so scans never dereference clients they skip
+	struct Slot {
+		explicit Slot(const ClientPtr& client);
+
+		SOCKET sockfd;
+
+		// owner is waiting for socket to take more data (write readiness or send completion)
+		bool waitingWrite;
+
+		// unsent data has reached high watermark and not yet fallen back to low watermark
+		bool writeBlocked;
+
+		// owner stopped reading requests of client
+		bool readPaused;
+
+		// io_uring recv of client is submitted and kernel has not completed it for the last time
+		bool recvPending;
+
+		// messages received since owner last took the count, used to find busy clients when load is rebalanced
+		unsigned recvMsgs;
+
+		ClientPtr client;
+	};
+
+	CellClientTable();
+
+	// nullptr when socket does not belong to a client of table
+	Slot* find(SOCKET sockfd);
+
+	// replace client of the same socket if there is one, state of slot starts over
+	Slot& insert(const ClientPtr& client);
+
+	// return false when socket does not belong to a client of table
+	bool erase(SOCKET sockfd);
+
+	void clear();
+
+	size_t size() const;
+
+	bool empty() const;
+
+	// walk clients by position, removing a client moves the last one into its position
+	Slot& at(size_t n);
+
+	std::vector<Slot>::iterator begin();
+	std::vector<Slot>::iterator end();
+
+private:
+	// socket numbers are small and reused by kernel (handles on windows are too), so they index slots directly,
+	// entry is position of slot plus one, zero when socket is not in table
+	std::vector<unsigned> _index;
+
+	std::vector<Slot> _slots;
+};
+
+#endif // !_CELL_CLIENT_TABLE_HPP_
@@ -0,0 +1,298 @@
+#include "CELLExecutor.hpp"
+#include "CELLAffinity.hpp"
+
+#include <functional>
+#include <chrono>
+#include <iostream>
+
+#ifdef __linux__
+#	include <sys/eventfd.h>
+#	include <unistd.h>
+#endif
+
+// executor and worker index of current thread, used to post tasks of a worker to its own queue
+static thread_local CellExecutor* tExecutor = nullptr;
+static thread_local int tWorkerIndex = -1;
+
+// time in microseconds used to measure how long tasks wait
+static long long nowMicroSec() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CellExecutor::Worker::Worker() :tasks{ CELL_EXECUTOR_QUEUE_SIZE }, overflow{}, count{ 0 }, totalLatency{ 0 }, maxLatency{ 0 } {}
+
+CellExecutor::CellExecutor(int nThreads) :_workers{}, _threads{}, _cpus{}, _next{ 0 }, _sleepers{ 0 }, isRun{ true } {
+	if (nThreads < 1) nThreads = 1;
+
+	for (int n = 0; n < nThreads; n++) {
+		_workers.emplace_back(new Worker());
+	}
+
+#	ifdef __linux__
+	_eventfd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
+#	else
+	_wakeups = 0;
+#	endif
+}
+
+// pin worker n to cpus[n % cpus.size()], empty to leave workers to scheduler, must be called before start()
+void CellExecutor::setCpus(const std::vector<int>& cpus) {
+	_cpus = cpus;
+}
+
+// launch worker threads
+void CellExecutor::start() {
+	for (int n = 0; n < (int)_workers.size(); n++) {
+		_threads.emplace_back(std::bind(&CellExecutor::OnRun, this, n));
+	}
+}
+
+// run task on any worker, called by any thread. a task posted by a worker goes to its own queue
+void CellExecutor::post(CellTaskPtr task) {
+	bool fromWorker = tExecutor == this;
+	int nWorkers = (int)_workers.size();
+	int index = fromWorker ? tWorkerIndex : (int)(_next++ % nWorkers);
+
+	Entry entry{ std::move(task), nowMicroSec() };
+
+	while (true) {
+		// a full queue passes task on to the next worker
+		for (int n = 0; n < nWorkers; n++) {
+			if (_workers[(index + n) % nWorkers]->tasks.push(std::move(entry))) {
+				wakeSleeper();
+				return;
+			}
+		}
+
+		if (fromWorker) {
+			_workers[index]->overflow.push_back(std::move(entry));
+			return;
+		}
+
+		// workers are busy draining all queues, none of them is sleeping
+		std::this_thread::yield();
+	}
+}
+
+// take task from own queue first, then from other workers
+bool CellExecutor::getTask(int index, Entry& entry) {
+	int nWorkers = (int)_workers.size();
+	Worker& worker = *_workers[index];
+
+	if (worker.tasks.pop(entry)) return true;
+
+	// overflow was posted after the queue filled up, so it comes after queued tasks
+	if (!worker.overflow.empty()) {
+		entry = std::move(worker.overflow.front());
+		worker.overflow.pop_front();
+		return true;
+	}
+
+	for (int n = 1; n < nWorkers; n++) {
+		if (_workers[(index + n) % nWorkers]->tasks.pop(entry)) return true;
+	}
+
+	return false;
+}
+
+// check all queues a worker could take a task from, before it goes to sleep
+bool CellExecutor::hasTask(int index) {
+	if (!_workers[index]->overflow.empty()) return true;
+
+	for (auto& worker : _workers) {
+		if (!worker->tasks.empty()) return true;
+	}
+
+	return false;
+}
+
+// wake up one sleeping worker, if there is any
+void CellExecutor::wakeSleeper() {
+	// pairs with the fence of a worker going to sleep, either it sees the task or we see it counted
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	int sleepers = _sleepers.load(std::memory_order_relaxed);
+	while (sleepers > 0 && !_sleepers.compare_exchange_weak(sleepers, sleepers - 1)) {}
+
+	if (sleepers > 0) notifyIdle(1);
+}
+
+// block idle worker until a poster or close() sends it a wakeup
+void CellExecutor::waitIdle() {
+#	ifdef __linux__
+	eventfd_t value;
+	eventfd_read(_eventfd, &value);
+#	else
+	std::unique_lock<std::mutex> lock(_idleMutex);
+	_idleCond.wait(lock, [this] { return _wakeups > 0; });
+	_wakeups--;
+#	endif
+}
+
+// send n wakeups, each one lets one idle worker go on
+void CellExecutor::notifyIdle(int n) {
+#	ifdef __linux__
+	eventfd_write(_eventfd, (eventfd_t)n);
+#	else
+	std::lock_guard<std::mutex> lock(_idleMutex);
+	_wakeups += n;
+	_idleCond.notify_all();
+#	endif
+}
+
+void CellExecutor::OnRun(int index) {
+	tExecutor = this;
+	tWorkerIndex = index;
+
+	if (!_cpus.empty()) {
+		int cpu = _cpus[index % _cpus.size()];
+		if (!CellAffinity::pinThread(cpu)) std::cout << "failed to pin worker to cpu " << cpu << std::endl;
+	}
+
+	Worker& worker = *_workers[index];
+	Entry entry;
+
+	while (true) {
+		if (getTask(index, entry)) {
+			long long latency = nowMicroSec() - entry.postTime;
+
+			worker.count.fetch_add(1, std::memory_order_relaxed);
+			worker.totalLatency.fetch_add(latency, std::memory_order_relaxed);
+			if (latency > worker.maxLatency.load(std::memory_order_relaxed)) worker.maxLatency.store(latency, std::memory_order_relaxed);
+
+			entry.task->doTask();
+
+			// task may hold the last reference of a client, it is released before worker sleeps
+			entry.task.reset();
+			continue;
+		}
+
+		// announce sleeping and check queues again, so a task posted in between is not missed
+		_sleepers++;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (hasTask(index) || !isRun) {
+			// take announcement back, unless a poster or close() has already taken it and sends a wakeup
+			int sleepers = _sleepers.load(std::memory_order_relaxed);
+			while (sleepers > 0 && !_sleepers.compare_exchange_weak(sleepers, sleepers - 1)) {}
+
+			if (sleepers == 0) waitIdle();
+
+			// queued tasks are done before worker exits
+			if (!isRun && !hasTask(index)) return;
+			continue;
+		}
+
+		// idle worker costs nothing until a task is posted
+		waitIdle();
+	}
+}
+
+// stop workers after queued tasks are done
+void CellExecutor::close() {
+	isRun = false;
+
+	// wake up every sleeping worker, a worker going to sleep meanwhile sees isRun itself
+	int sleepers = _sleepers.exchange(0);
+	if (sleepers > 0) notifyIdle(sleepers);
+
+	for (auto& t : _threads) {
+		if (t.joinable()) t.join();
+	}
+	_threads.clear();
+}
+
+int CellExecutor::getThreadCount() const {
+	return (int)_workers.size();
+}
+
+// take counters and reset them, called by any thread,
+// tasks in overflow of a worker are only seen by that worker and not counted in depth
+CellExecutorStats CellExecutor::takeStats() {
+	CellExecutorStats stats;
+
+	for (auto& worker : _workers) {
+		stats.depth += worker->tasks.size();
+		stats.count += worker->count.exchange(0, std::memory_order_relaxed);
+		stats.totalLatencyUs += worker->totalLatency.exchange(0, std::memory_order_relaxed);
+
+		long long maxLatency = worker->maxLatency.exchange(0, std::memory_order_relaxed);
+		if (maxLatency > stats.maxLatencyUs) stats.maxLatencyUs = maxLatency;
+	}
+
+	return stats;
+}
+
+CellExecutor::~CellExecutor() {
+	close();
+
+#	ifdef __linux__
+	if (_eventfd >= 0) ::close(_eventfd);
+#	endif
+}
+
+// onDrained is called by worker when a throttled strand has caught up
+CellStrand::CellStrand(CellExecutor* pExecutor, std::function<void()> onDrained) :_pExecutor{ pExecutor }, _mutex{}, _tasks{}, _scheduled{ false }, _throttled{ false }, _onDrained{ onDrained } {}
+
+// queue task, the strand is handed to executor when it is not already scheduled
+void CellStrand::post(CellTaskPtr task) {
+	bool schedule = false;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_tasks.push_back(std::move(task));
+		if (_tasks.size() >= CELL_STRAND_MAX_PENDING) _throttled = true;
+
+		schedule = !_scheduled;
+		_scheduled = true;
+	}
+
+	if (schedule) _pExecutor->post(shared_from_this());
+}
+
+// no task is queued or running, a task can then be run by caller directly without breaking order
+bool CellStrand::isIdle() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return !_scheduled;
+}
+
+// too many tasks are queued, poster should stop posting until onDrained is called
+bool CellStrand::isThrottled() {
+	return _throttled;
+}
+
+// run queued tasks, called by executor
+void CellStrand::doTask() {
+	for (int n = 0; n < CELL_STRAND_BATCH; n++) {
+		CellTaskPtr task;
+		bool drained = false;
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			// strand stays scheduled until its last task is done, so no other worker runs it meanwhile
+			if (_tasks.empty()) {
+				_scheduled = false;
+				return;
+			}
+
+			task = std::move(_tasks.front());
+			_tasks.pop_front();
+
+			if (_throttled && _tasks.size() <= CELL_STRAND_MAX_PENDING / 4) {
+				_throttled = false;
+				drained = true;
+			}
+		}
+
+		// task holds its client, so the client is still alive when it is told to go on
+		if (drained && _onDrained) _onDrained();
+
+		task->doTask();
+	}
+
+	// a flooding connection goes back to the end of queue, so it cannot hold a worker forever
+	_pExecutor->post(shared_from_this());
+}
+
+CellStrand::~CellStrand() = default;
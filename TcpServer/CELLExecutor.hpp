@@ -0,0 +1,176 @@
+#ifndef _CELL_EXECUTOR_HPP_
+#define _CELL_EXECUTOR_HPP_
+
+#include "CELLTask.hpp"
+#include "CELLQueue.hpp"
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <functional>
+
+// number of tasks the queue of one worker can hold, must be power of 2
+#ifndef CELL_EXECUTOR_QUEUE_SIZE
+#define CELL_EXECUTOR_QUEUE_SIZE 4096
+#endif
+
+// maximum number of tasks a strand runs before it lets other strands of the same worker run
+#define CELL_STRAND_BATCH 64
+
+// number of queued tasks which makes a strand ask its poster to stop, it is told to go on at a quarter of it
+#define CELL_STRAND_MAX_PENDING 1024
+
+// counters of executor, latency is measured from post() until a worker starts the task
+struct CellExecutorStats {
+	// tasks waiting in queues when stats are taken
+	size_t depth = 0;
+
+	// tasks started since stats were taken last time
+	long long count = 0;
+
+	long long totalLatencyUs = 0;
+	long long maxLatencyUs = 0;
+};
+
+// pool of worker threads running message handlers away from I/O threads.
+// every worker owns a bounded lock-free queue of tasks, a worker without tasks steals from the others,
+// so a few busy connections are spread over all workers. idle workers block until a task is posted
+class CellExecutor {
+public:
+	using CellTaskPtr = std::shared_ptr<CellTask>;
+
+	explicit CellExecutor(int nThreads);
+
+	CellExecutor(const CellExecutor&) = delete;
+	void operator=(const CellExecutor&) = delete;
+
+	// pin worker n to cpus[n % cpus.size()], empty to leave workers to scheduler, must be called before start()
+	void setCpus(const std::vector<int>& cpus);
+
+	// launch worker threads
+	void start();
+
+	// run task on any worker, called by any thread. a task posted by a worker goes to its own queue
+	void post(CellTaskPtr task);
+
+	// stop workers after queued tasks are done
+	void close();
+
+	int getThreadCount() const;
+
+	// take counters and reset them, called by any thread,
+	// tasks in overflow of a worker are only seen by that worker and not counted in depth
+	CellExecutorStats takeStats();
+
+	~CellExecutor();
+
+private:
+	// task and the time it was posted, to measure how long it waits
+	struct Entry {
+		CellTaskPtr task;
+		long long postTime;
+	};
+
+	// queue of one worker, owner and thieves both take tasks from front
+	struct Worker {
+		Worker();
+
+		CellMpmcQueue<Entry> tasks;
+
+		// tasks posted by this worker while all queues are full, only used by its own thread,
+		// so a worker never waits for queues which only it would drain
+		std::deque<Entry> overflow;
+
+		// written by this worker, taken by takeStats()
+		std::atomic<long long> count;
+		std::atomic<long long> totalLatency;
+		std::atomic<long long> maxLatency;
+	};
+
+	void OnRun(int index);
+
+	// take task from own queue first, then from other workers
+	bool getTask(int index, Entry& entry);
+
+	// check all queues a worker could take a task from, before it goes to sleep
+	bool hasTask(int index);
+
+	// wake up one sleeping worker, if there is any
+	void wakeSleeper();
+
+	// block idle worker until a poster or close() sends it a wakeup
+	void waitIdle();
+
+	// send n wakeups, each one lets one idle worker go on
+	void notifyIdle(int n);
+
+	std::vector<std::unique_ptr<Worker>> _workers;
+
+	std::vector<std::thread> _threads;
+
+	std::vector<int> _cpus;
+
+	// queue of next task posted by a thread which is not a worker
+	std::atomic<unsigned> _next;
+
+	// workers going to sleep which have not been sent a wakeup yet,
+	// whoever takes one off the count sends exactly one wakeup
+	std::atomic<int> _sleepers;
+
+#	ifdef __linux__
+	// semaphore, every read takes one wakeup and blocks while there is none
+	int _eventfd;
+#	else
+	std::mutex _idleMutex;
+	std::condition_variable _idleCond;
+	int _wakeups;
+#	endif
+
+	std::atomic<bool> isRun;
+};
+
+// tasks of one connection, run one at a time and in the order they are posted,
+// while tasks of different connections run on different workers in parallel
+class CellStrand : public CellTask, public std::enable_shared_from_this<CellStrand> {
+public:
+	using CellTaskPtr = std::shared_ptr<CellTask>;
+
+	// onDrained is called by worker when a throttled strand has caught up
+	CellStrand(CellExecutor* pExecutor, std::function<void()> onDrained);
+
+	// queue task, the strand is handed to executor when it is not already scheduled
+	void post(CellTaskPtr task);
+
+	// no task is queued or running, a task can then be run by caller directly without breaking order
+	bool isIdle();
+
+	// too many tasks are queued, poster should stop posting until onDrained is called
+	bool isThrottled();
+
+	// run queued tasks, called by executor
+	virtual void doTask() override;
+
+	virtual ~CellStrand();
+
+private:
+	CellExecutor* _pExecutor;
+
+	std::mutex _mutex;
+
+	std::deque<CellTaskPtr> _tasks;
+
+	// strand is queued in or run by executor
+	bool _scheduled;
+
+	std::atomic<bool> _throttled;
+
+	std::function<void()> _onDrained;
+};
+
+using CellStrandPtr = std::shared_ptr<CellStrand>;
+
+#endif // !_CELL_EXECUTOR_HPP_
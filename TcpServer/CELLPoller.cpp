@@ -0,0 +1,315 @@
+#include "CELLPoller.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#	include <errno.h>
+#	include <sys/eventfd.h>
+#endif
+
+std::unique_ptr<CellPoller> CellPoller::create(CellPollerType type) {
+#	ifdef __linux__
+	if (type == CellPollerType::Default) type = CellPollerType::Epoll;
+
+	if (type == CellPollerType::Epoll || type == CellPollerType::EpollLT) {
+		std::unique_ptr<CellEpollPoller> poller(new CellEpollPoller(type == CellPollerType::Epoll));
+		if (poller->isValid()) return poller;
+
+		std::cout << "epoll is not available, fall back to select" << std::endl;
+	}
+#	endif
+
+	return std::unique_ptr<CellPoller>(new CellSelectPoller());
+}
+
+CellSelectPoller::CellSelectPoller() :_socks{}, _pausedSocks{}, _writeSocks{}, _wakeSock{ INVALID_SOCKET }, _socks_change{ true }, _maxSock{ 0 } {
+	FD_ZERO(&_fdRead_pre);
+
+	// select cannot wait on anything but sockets in windows, so wakeup is a datagram sent to ourselves
+	_wakeSock = socket(AF_INET, SOCK_DGRAM, 0);
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = 0;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int nAddrLen = sizeof(addr);
+
+	if (_wakeSock == INVALID_SOCKET
+		|| bind(_wakeSock, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR
+#	ifdef _WIN32
+		|| getsockname(_wakeSock, (sockaddr*)&addr, &nAddrLen) == SOCKET_ERROR
+#	else
+		|| getsockname(_wakeSock, (sockaddr*)&addr, (socklen_t*)&nAddrLen) == SOCKET_ERROR
+#	endif
+		|| connect(_wakeSock, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+		std::cout << "failed to create wakeup socket of select" << std::endl;
+		return;
+	}
+
+	setNonBlocking(_wakeSock);
+}
+
+bool CellSelectPoller::addSocket(SOCKET sock) {
+	// select cannot monitor more sockets than FD_SETSIZE, one of them is used by wakeup socket
+#	ifdef _WIN32
+	if (_socks.size() + 1 >= FD_SETSIZE) return false;
+#	else
+	if (sock >= FD_SETSIZE) return false;
+#	endif
+
+	_socks.push_back(sock);
+	_socks_change = true;
+	return true;
+}
+
+bool CellSelectPoller::delSocket(SOCKET sock) {
+	auto iter = std::find(_socks.begin(), _socks.end(), sock);
+	auto paused = std::find(_pausedSocks.begin(), _pausedSocks.end(), sock);
+
+	if (iter == _socks.end() && paused == _pausedSocks.end()) return false;
+
+	if (iter != _socks.end()) {
+		_socks.erase(iter);
+		_socks_change = true;
+	}
+	else {
+		_pausedSocks.erase(paused);
+	}
+
+	auto writeIter = std::find(_writeSocks.begin(), _writeSocks.end(), sock);
+	if (writeIter != _writeSocks.end()) _writeSocks.erase(writeIter);
+
+	return true;
+}
+
+bool CellSelectPoller::modSocket(SOCKET sock, bool readable, bool writable) {
+	auto iter = std::find(_socks.begin(), _socks.end(), sock);
+	auto paused = std::find(_pausedSocks.begin(), _pausedSocks.end(), sock);
+
+	if (iter == _socks.end() && paused == _pausedSocks.end()) return false;
+
+	// paused socket is moved out of read set and back when reading resumes
+	if (!readable && iter != _socks.end()) {
+		_socks.erase(iter);
+		_pausedSocks.push_back(sock);
+		_socks_change = true;
+	}
+
+	if (readable && paused != _pausedSocks.end()) {
+		_pausedSocks.erase(paused);
+		_socks.push_back(sock);
+		_socks_change = true;
+	}
+
+	auto writeIter = std::find(_writeSocks.begin(), _writeSocks.end(), sock);
+
+	if (writable && writeIter == _writeSocks.end()) _writeSocks.push_back(sock);
+	if (!writable && writeIter != _writeSocks.end()) _writeSocks.erase(writeIter);
+
+	return true;
+}
+
+void CellSelectPoller::wakeup() {
+	char c = 0;
+	send(_wakeSock, &c, 1, 0);
+}
+
+int CellSelectPoller::wait(int timeoutMs, std::vector<CellPollEvent>& events) {
+	events.clear();
+
+	// fd_set: a struct which can be placed sockets into a "set" for various purposes, such as testing a given socket for readability using the readfds parameter of the select function
+	fd_set fdRead;
+	fd_set fdWrite;
+
+	// reset the count of each set to zero
+	FD_ZERO(&fdRead);
+	FD_ZERO(&fdWrite);
+
+	// only update file descriptor set when sockets are added or removed
+	if (_socks_change) {
+		_maxSock = _wakeSock;
+		FD_SET(_wakeSock, &fdRead);
+
+		for (auto sock : _socks) {
+			FD_SET(sock, &fdRead);
+			if (_maxSock < sock) _maxSock = sock;
+		}
+
+		// back up an new file descriptor set
+		memcpy(&_fdRead_pre, &fdRead, sizeof(fd_set));
+		_socks_change = false;
+	}
+	else {
+		memcpy(&fdRead, &_fdRead_pre, sizeof(fd_set));
+	}
+
+	// only few sockets wait for writability, so write set is always rebuilt
+	for (auto sock : _writeSocks) {
+		FD_SET(sock, &fdWrite);
+	}
+
+	// last arg is timeout: The maximum time for select to wait for checking status of sockets
+	timeval t = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+
+	int ret = select((int)_maxSock + 1, &fdRead, _writeSocks.empty() ? nullptr : &fdWrite, nullptr, timeoutMs < 0 ? nullptr : &t);
+
+	if (ret <= 0) return ret;
+
+	if (FD_ISSET(_wakeSock, &fdRead)) {
+		// drain all wakeups sent since last wait
+		char buf[64];
+		while (recv(_wakeSock, buf, sizeof(buf), 0) > 0) {}
+	}
+
+	// a socket both readable and writable is reported once, like epoll does,
+	// so an event which removes the client is not followed by another one for it
+#	ifdef _WIN32
+	// fd array is a socket array in windows, while in unix it is a bitmask
+	for (u_int n = 0; n < fdRead.fd_count; n++) {
+		SOCKET sock = fdRead.fd_array[n];
+		if (sock != _wakeSock) events.push_back({ sock, true, FD_ISSET(sock, &fdWrite) != 0, false });
+	}
+
+	for (u_int n = 0; n < fdWrite.fd_count; n++) {
+		SOCKET sock = fdWrite.fd_array[n];
+		if (!FD_ISSET(sock, &fdRead)) events.push_back({ sock, false, true, false });
+	}
+#	else
+	for (auto sock : _socks) {
+		if (FD_ISSET(sock, &fdRead)) {
+			events.push_back({ sock, true, FD_ISSET(sock, &fdWrite) != 0, false });
+		}
+	}
+
+	// sockets which are only writable, paused ones among them
+	for (auto sock : _writeSocks) {
+		if (FD_ISSET(sock, &fdWrite) && !FD_ISSET(sock, &fdRead)) {
+			events.push_back({ sock, false, true, false });
+		}
+	}
+#	endif
+
+	return (int)events.size();
+}
+
+bool CellSelectPoller::isEdgeTriggered() const {
+	return false;
+}
+
+const char* CellSelectPoller::name() const {
+	return "select";
+}
+
+CellSelectPoller::~CellSelectPoller() {
+	if (_wakeSock == INVALID_SOCKET) return;
+
+#	ifdef _WIN32
+	closesocket(_wakeSock);
+#	else
+	close(_wakeSock);
+#	endif
+}
+
+#ifdef __linux__
+CellEpollPoller::CellEpollPoller(bool edgeTriggered) :_epfd{ -1 }, _wakefd{ -1 }, _edgeTriggered{ edgeTriggered }, _events(256) {
+	_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (_epfd < 0) return;
+
+	// counter written by other threads, readable until it is drained in wait()
+	_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = _wakefd;
+
+	if (_wakefd < 0 || epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakefd, &ev) != 0) {
+		close(_epfd);
+		_epfd = -1;
+	}
+}
+
+bool CellEpollPoller::isValid() const {
+	return _epfd >= 0;
+}
+
+bool CellEpollPoller::addSocket(SOCKET sock) {
+	epoll_event ev = {};
+
+	// EPOLLRDHUP reports peer shutdown even if there is no data left to read
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	if (_edgeTriggered) ev.events |= EPOLLET;
+	ev.data.fd = sock;
+
+	return epoll_ctl(_epfd, EPOLL_CTL_ADD, sock, &ev) == 0;
+}
+
+bool CellEpollPoller::delSocket(SOCKET sock) {
+	// non-null event pointer keeps compatibility with kernels before 2.6.9
+	epoll_event ev = {};
+	return epoll_ctl(_epfd, EPOLL_CTL_DEL, sock, &ev) == 0;
+}
+
+bool CellEpollPoller::modSocket(SOCKET sock, bool readable, bool writable) {
+	epoll_event ev = {};
+
+	// modifying re-arms edge-triggered socket, so data arrived while paused is reported again
+	if (readable) ev.events |= EPOLLIN | EPOLLRDHUP;
+	if (writable) ev.events |= EPOLLOUT;
+	if (_edgeTriggered) ev.events |= EPOLLET;
+	ev.data.fd = sock;
+
+	return epoll_ctl(_epfd, EPOLL_CTL_MOD, sock, &ev) == 0;
+}
+
+void CellEpollPoller::wakeup() {
+	eventfd_write(_wakefd, 1);
+}
+
+int CellEpollPoller::wait(int timeoutMs, std::vector<CellPollEvent>& events) {
+	events.clear();
+
+	int ret = epoll_wait(_epfd, _events.data(), (int)_events.size(), timeoutMs);
+
+	if (ret < 0) {
+		// interrupted by signal is not an error
+		return errno == EINTR ? 0 : -1;
+	}
+
+	for (int n = 0; n < ret; n++) {
+		const epoll_event& ev = _events[n];
+
+		if (ev.data.fd == _wakefd) {
+			eventfd_t value;
+			eventfd_read(_wakefd, &value);
+			continue;
+		}
+
+		// let reader detect EOF or error by recv() so that buffered data is still processed
+		bool readable = (ev.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+		bool writable = (ev.events & EPOLLOUT) != 0;
+		bool error = (ev.events & EPOLLERR) != 0;
+
+		events.push_back({ ev.data.fd, readable, writable, error });
+	}
+
+	// buffer is filled up, enlarge it to collect more events in one call
+	if (ret == (int)_events.size()) _events.resize(_events.size() * 2);
+
+	return (int)events.size();
+}
+
+bool CellEpollPoller::isEdgeTriggered() const {
+	return _edgeTriggered;
+}
+
+const char* CellEpollPoller::name() const {
+	return _edgeTriggered ? "epoll(ET)" : "epoll(LT)";
+}
+
+CellEpollPoller::~CellEpollPoller() {
+	if (_wakefd >= 0) close(_wakefd);
+	if (_epfd >= 0) close(_epfd);
+}
+#endif
@@ -0,0 +1,162 @@
+#ifndef _CELL_POLLER_HPP_
+#define _CELL_POLLER_HPP_
+
+#include "Cell.hpp"
+
+#include <vector>
+#include <memory>
+
+#ifdef __linux__
+#	include <sys/epoll.h>
+#endif
+
+// readiness event reported by a poller for one socket
+struct CellPollEvent {
+	SOCKET sockfd;
+
+	// data (or a peer shutdown) can be read from socket
+	bool readable;
+
+	// socket can take more data to send, only reported while write readiness is monitored
+	bool writable;
+
+	// socket is closed or in error state, the owner should drop it
+	bool error;
+};
+
+// backends which can be chosen when launching the server
+enum class CellPollerType {
+	// epoll on linux, select on other platforms
+	Default,
+	// portable select, limited to FD_SETSIZE sockets
+	Select,
+	// edge-triggered epoll, readers must drain socket until EAGAIN
+	Epoll,
+	// level-triggered epoll, one recv per ready event is enough
+	EpollLT
+};
+
+// interface of readiness notification, each child server owns one poller
+// so that the cost per iteration depends on number of ready sockets, not on number of clients
+class CellPoller {
+public:
+	CellPoller() = default;
+
+	// poller owns kernel resources and should not be copied
+	CellPoller(const CellPoller&) = delete;
+	void operator=(const CellPoller&) = delete;
+
+	// start monitoring readability of a socket
+	virtual bool addSocket(SOCKET sock) = 0;
+
+	// stop monitoring a socket, must be called before socket is closed
+	virtual bool delSocket(SOCKET sock) = 0;
+
+	// change what is monitored for a socket: writability while it has data which cannot be sent yet,
+	// readability is turned off while reading from it is paused
+	virtual bool modSocket(SOCKET sock, bool readable, bool writable) = 0;
+
+	// interrupt wait() from another thread, the wakeup itself is not reported as an event
+	virtual void wakeup() = 0;
+
+	// wait until at least one socket is ready or timeout (in millisecond) expires,
+	// ready sockets are stored into events, return number of events or -1 on error
+	virtual int wait(int timeoutMs, std::vector<CellPollEvent>& events) = 0;
+
+	// with edge-triggered notification a socket is reported only once per arrival of new data
+	virtual bool isEdgeTriggered() const = 0;
+
+	virtual const char* name() const = 0;
+
+	virtual ~CellPoller() = default;
+
+	// create poller of given type, fall back to select when backend is not supported
+	static std::unique_ptr<CellPoller> create(CellPollerType type);
+};
+
+// portable backend based on select()
+class CellSelectPoller : public CellPoller {
+public:
+	CellSelectPoller();
+
+	virtual bool addSocket(SOCKET sock) override;
+
+	virtual bool delSocket(SOCKET sock) override;
+
+	virtual bool modSocket(SOCKET sock, bool readable, bool writable) override;
+
+	virtual void wakeup() override;
+
+	virtual int wait(int timeoutMs, std::vector<CellPollEvent>& events) override;
+
+	virtual bool isEdgeTriggered() const override;
+
+	virtual const char* name() const override;
+
+	virtual ~CellSelectPoller();
+
+private:
+	// all monitored sockets
+	std::vector<SOCKET> _socks;
+
+	// sockets whose readability is not monitored while reading is paused
+	std::vector<SOCKET> _pausedSocks;
+
+	// sockets whose writability is monitored
+	std::vector<SOCKET> _writeSocks;
+
+	// udp socket connected to itself, a datagram sent to it interrupts select()
+	SOCKET _wakeSock;
+
+	// backup of file descriptor set, only rebuilt when sockets are added or removed
+	fd_set _fdRead_pre;
+
+	// check if any sockets are added or removed
+	bool _socks_change;
+
+	// used in linux environment
+	SOCKET _maxSock;
+};
+
+#ifdef __linux__
+// linux backend based on epoll, no limit on the number of sockets
+class CellEpollPoller : public CellPoller {
+public:
+	explicit CellEpollPoller(bool edgeTriggered);
+
+	// check if epoll instance is created
+	bool isValid() const;
+
+	virtual bool addSocket(SOCKET sock) override;
+
+	virtual bool delSocket(SOCKET sock) override;
+
+	virtual bool modSocket(SOCKET sock, bool readable, bool writable) override;
+
+	virtual void wakeup() override;
+
+	virtual int wait(int timeoutMs, std::vector<CellPollEvent>& events) override;
+
+	virtual bool isEdgeTriggered() const override;
+
+	virtual const char* name() const override;
+
+	virtual ~CellEpollPoller();
+
+private:
+	// epoll instance
+	int _epfd;
+
+	// eventfd written by wakeup()
+	int _wakefd;
+
+	bool _edgeTriggered;
+
+	// buffer filled by epoll_wait, grows when it is filled up in one call
+	std::vector<epoll_event> _events;
+};
+#endif
+
+using CellPollerPtr = std::unique_ptr<CellPoller>;
+
+#endif // !_CELL_POLLER_HPP_
@@ -0,0 +1,213 @@
+#ifndef _CELL_QUEUE_HPP_
+#define _CELL_QUEUE_HPP_
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+// bounded multi-producer single-consumer ring, producers reserve a slot with one
+// compare-and-swap and items are moved in and out, so no memory is allocated per item.
+// size must be power of 2
+template<class T>
+class CellMpscQueue {
+public:
+	explicit CellMpscQueue(size_t nSize) :_slots{ new Slot[nSize] }, _mask{ nSize - 1 }, _enqueuePos{ 0 }, _dequeuePos{ 0 } {
+		// slot n is free for the producer holding position n
+		for (size_t n = 0; n <= _mask; n++) {
+			_slots[n].seq.store(n, std::memory_order_relaxed);
+		}
+	}
+
+	CellMpscQueue(const CellMpscQueue&) = delete;
+	void operator=(const CellMpscQueue&) = delete;
+
+	// called by any thread, never blocks, return false when queue is full
+	bool push(T&& item) {
+		size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+		Slot* pSlot = nullptr;
+
+		while (true) {
+			pSlot = &_slots[pos & _mask];
+			size_t seq = pSlot->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+			// slot is free, reserve it by moving enqueue position forward
+			if (diff == 0) {
+				if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			}
+			// slot still holds an item from the previous round, queue is full
+			else if (diff < 0) {
+				return false;
+			}
+			// another producer has taken this position
+			else {
+				pos = _enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		pSlot->item = std::move(item);
+
+		// publish item to consumer
+		pSlot->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// take next item, only called by consumer thread, return false when queue is empty
+	bool pop(T& item) {
+		size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+		Slot& slot = _slots[pos & _mask];
+
+		if (slot.seq.load(std::memory_order_acquire) != pos + 1) return false;
+
+		item = std::move(slot.item);
+
+		// slot becomes free for the producer of the next round
+		slot.seq.store(pos + _mask + 1, std::memory_order_release);
+		_dequeuePos.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// check queue without taking item, only called by consumer thread
+	bool empty() {
+		size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+		return _slots[pos & _mask].seq.load(std::memory_order_acquire) != pos + 1;
+	}
+
+	// number of items queued, called by any thread,
+	// positions are read one after another, reserved but unpublished items are counted as well
+	size_t size() {
+		size_t enqueuePos = _enqueuePos.load(std::memory_order_relaxed);
+		size_t dequeuePos = _dequeuePos.load(std::memory_order_relaxed);
+		return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+	}
+
+private:
+	// one entry of ring, sequence number tells whether it is free or holds an item
+	struct Slot {
+		std::atomic<size_t> seq;
+		T item;
+	};
+
+	std::unique_ptr<Slot[]> _slots;
+
+	size_t _mask;
+
+	// written by producers and consumer, kept apart so they do not share a cache line
+	std::atomic<size_t> _enqueuePos;
+	char _pad1[64];
+	std::atomic<size_t> _dequeuePos;
+	char _pad2[64];
+};
+
+// bounded multi-producer multi-consumer ring, the same as CellMpscQueue except that consumers
+// also take an item with one compare-and-swap, so idle threads can take items from the queue of another.
+// size must be power of 2
+template<class T>
+class CellMpmcQueue {
+public:
+	explicit CellMpmcQueue(size_t nSize) :_slots{ new Slot[nSize] }, _mask{ nSize - 1 }, _enqueuePos{ 0 }, _dequeuePos{ 0 } {
+		// slot n is free for the producer holding position n
+		for (size_t n = 0; n <= _mask; n++) {
+			_slots[n].seq.store(n, std::memory_order_relaxed);
+		}
+	}
+
+	CellMpmcQueue(const CellMpmcQueue&) = delete;
+	void operator=(const CellMpmcQueue&) = delete;
+
+	// called by any thread, never blocks, return false when queue is full, item is then left untouched
+	bool push(T&& item) {
+		size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+		Slot* pSlot = nullptr;
+
+		while (true) {
+			pSlot = &_slots[pos & _mask];
+			size_t seq = pSlot->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+			// slot is free, reserve it by moving enqueue position forward
+			if (diff == 0) {
+				if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			}
+			// slot still holds an item from the previous round, queue is full
+			else if (diff < 0) {
+				return false;
+			}
+			// another producer has taken this position
+			else {
+				pos = _enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		pSlot->item = std::move(item);
+
+		// publish item to consumers
+		pSlot->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// take next item, called by any thread, return false when queue is empty
+	bool pop(T& item) {
+		size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+		Slot* pSlot = nullptr;
+
+		while (true) {
+			pSlot = &_slots[pos & _mask];
+			size_t seq = pSlot->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+			// slot holds an item, claim it by moving dequeue position forward
+			if (diff == 0) {
+				if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			}
+			// item of this position is not published yet, queue is empty
+			else if (diff < 0) {
+				return false;
+			}
+			// another consumer has taken this position
+			else {
+				pos = _dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		item = std::move(pSlot->item);
+
+		// slot becomes free for the producer of the next round
+		pSlot->seq.store(pos + _mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	// check queue without taking item, called by any thread
+	bool empty() {
+		size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+		return _slots[pos & _mask].seq.load(std::memory_order_acquire) != pos + 1;
+	}
+
+	// number of items queued, called by any thread,
+	// positions are read one after another, reserved but unpublished items are counted as well
+	size_t size() {
+		size_t enqueuePos = _enqueuePos.load(std::memory_order_relaxed);
+		size_t dequeuePos = _dequeuePos.load(std::memory_order_relaxed);
+		return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+	}
+
+private:
+	// one entry of ring, sequence number tells whether it is free or holds an item
+	struct Slot {
+		std::atomic<size_t> seq;
+		T item;
+	};
+
+	std::unique_ptr<Slot[]> _slots;
+
+	size_t _mask;
+
+	// written by producers and consumers, kept apart so they do not share a cache line
+	std::atomic<size_t> _enqueuePos;
+	char _pad1[64];
+	std::atomic<size_t> _dequeuePos;
+	char _pad2[64];
+};
+
+#endif // !_CELL_QUEUE_HPP_
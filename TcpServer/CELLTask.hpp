@@ -2,10 +2,8 @@
 #define _CELL_TASK_H_
 
 #include "Client.hpp"
+#include "INetEvent.hpp"
 
-#include <thread>
-#include <mutex>
-#include <list>
 #include <memory>
 
 class CellTask {
@@ -20,47 +18,22 @@ class CellTask {
 
 };
 
-class CellTaskServer {
-	public:
-		using CellTaskPtr = std::shared_ptr<CellTask>;
-
-		CellTaskServer();
-
-		// launch server thread
-		void start();
-
-		void addTask(CellTaskPtr& task);
-		
-		~CellTaskServer();
-
-	protected:
-		void OnRun();
-
-	private:
-		// 
-		std::list<CellTaskPtr> _tasks;
-
-		std::list<CellTaskPtr> _tasksBuf;
-
-		std::mutex _mutex;
-		
-		bool isRun;
-};
-
-// network message sending service
-class CellSendMsgToClientTask : public CellTask {
+// message handling service, runs handler on a worker thread with a retained copy of message
+class CellNetMsgTask : public CellTask {
 public:
-	CellSendMsgToClientTask(ClientPtr pClient, DataHeaderPtr& pHeader);
+	CellNetMsgTask(INetEvent* pNetEvent, ChildServer* pChildServer, ClientPtr pClient, MsgBuf msg);
 
 	virtual void doTask() override;
 
-	virtual ~CellSendMsgToClientTask();
+	virtual ~CellNetMsgTask();
 
 private:
+	INetEvent* _pNetEvent;
+	ChildServer* _pChildServer;
 	ClientPtr _pClient;
-	DataHeaderPtr _pHeader;
+	MsgBuf _msg;
 };
 
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,266 @@
+#include "CELLUring.hpp"
+
+#ifdef CELL_HAS_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// buffer group id of registered receive buffers, each ring has only one group
+#define CELL_URING_BGID 0
+
+static int io_uring_setup(unsigned entries, io_uring_params* p) {
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize) {
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nrArgs) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+CellUring::CellUring() :_ringfd{ -1 }, _sqHead{ nullptr }, _sqTail{ nullptr }, _sqMask{ 0 }, _sqEntries{ 0 }, _sqes{ nullptr }, _sqLocalTail{ 0 },
+						_cqHead{ nullptr }, _cqTail{ nullptr }, _cqMask{ 0 }, _cqes{ nullptr },
+						_sqPtr{ nullptr }, _sqSize{ 0 }, _cqPtr{ nullptr }, _cqSize{ 0 }, _sqesSize{ 0 },
+						_bufRing{ nullptr }, _bufs{ nullptr }, _nBufs{ 0 }, _bufSize{ 0 } {}
+
+bool CellUring::init(unsigned entries, unsigned nBufs, unsigned bufSize) {
+	io_uring_params p = {};
+
+	_ringfd = io_uring_setup(entries, &p);
+	if (_ringfd < 0) return false;
+
+	// multishot requests and waiting with timeout require kernel features after 5.11
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) return false;
+
+	// submission and completion rings share one mapping
+	_sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	_cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	if (_cqSize > _sqSize) _sqSize = _cqSize;
+	_cqSize = _sqSize;
+
+	_sqPtr = mmap(nullptr, _sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQ_RING);
+	if (_sqPtr == MAP_FAILED) {
+		_sqPtr = nullptr;
+		return false;
+	}
+	_cqPtr = _sqPtr;
+
+	_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+	_sqes = (io_uring_sqe*)mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQES);
+	if (_sqes == MAP_FAILED) {
+		_sqes = nullptr;
+		return false;
+	}
+
+	char* sq = (char*)_sqPtr;
+	_sqHead = (unsigned*)(sq + p.sq_off.head);
+	_sqTail = (unsigned*)(sq + p.sq_off.tail);
+	_sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+	_sqEntries = *(unsigned*)(sq + p.sq_off.ring_entries);
+	_sqLocalTail = *_sqTail;
+
+	// entries are always used in order, so the index array can be an identity mapping
+	unsigned* array = (unsigned*)(sq + p.sq_off.array);
+	for (unsigned n = 0; n < _sqEntries; n++) {
+		array[n] = n;
+	}
+
+	char* cq = (char*)_cqPtr;
+	_cqHead = (unsigned*)(cq + p.cq_off.head);
+	_cqTail = (unsigned*)(cq + p.cq_off.tail);
+	_cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+	_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	if (nBufs == 0) return true;
+
+	// register ring of receive buffers, kernel picks one of them when data arrives
+	_nBufs = nBufs;
+	_bufSize = bufSize;
+
+	void* ring = nullptr;
+	if (posix_memalign(&ring, 4096, _nBufs * sizeof(io_uring_buf)) != 0) return false;
+	_bufRing = (io_uring_buf_ring*)ring;
+
+	void* bufs = nullptr;
+	if (posix_memalign(&bufs, 4096, (size_t)_nBufs * _bufSize) != 0) return false;
+	_bufs = (char*)bufs;
+
+	io_uring_buf_reg reg = {};
+	reg.ring_addr = (uint64_t)(uintptr_t)_bufRing;
+	reg.ring_entries = _nBufs;
+	reg.bgid = CELL_URING_BGID;
+
+	if (io_uring_register(_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return false;
+
+	_bufRing->tail = 0;
+	for (unsigned n = 0; n < _nBufs; n++) {
+		recycleBuffer(n);
+	}
+
+	return true;
+}
+
+io_uring_sqe* CellUring::getSqe() {
+	unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+
+	if (_sqLocalTail - head >= _sqEntries) {
+		// submission queue is full, hand queued entries to kernel without waiting
+		__atomic_store_n(_sqTail, _sqLocalTail, __ATOMIC_RELEASE);
+		io_uring_enter(_ringfd, _sqLocalTail - head, 0, 0, nullptr, 0);
+
+		head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+		if (_sqLocalTail - head >= _sqEntries) return nullptr;
+	}
+
+	io_uring_sqe* sqe = &_sqes[_sqLocalTail & _sqMask];
+	_sqLocalTail++;
+
+	memset(sqe, 0, sizeof(io_uring_sqe));
+	return sqe;
+}
+
+bool CellUring::prepRecvMultishot(SOCKET sock, uint64_t userData) {
+	io_uring_sqe* sqe = getSqe();
+	if (!sqe) return false;
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sock;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = CELL_URING_BGID;
+	sqe->user_data = userData;
+	return true;
+}
+
+bool CellUring::prepAcceptMultishot(SOCKET sock, uint64_t userData) {
+	io_uring_sqe* sqe = getSqe();
+	if (!sqe) return false;
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = sock;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = userData;
+	return true;
+}
+
+bool CellUring::prepSend(SOCKET sock, const char* pBuf, unsigned nLen, uint64_t userData) {
+	io_uring_sqe* sqe = getSqe();
+	if (!sqe) return false;
+
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = sock;
+	sqe->addr = (uint64_t)(uintptr_t)pBuf;
+	sqe->len = nLen;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = userData;
+	return true;
+}
+
+bool CellUring::prepCancel(uint64_t target, uint64_t userData) {
+	io_uring_sqe* sqe = getSqe();
+	if (!sqe) return false;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = userData;
+	return true;
+}
+
+bool CellUring::prepRead(int fd, void* pBuf, unsigned nLen, uint64_t userData) {
+	io_uring_sqe* sqe = getSqe();
+	if (!sqe) return false;
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)pBuf;
+	sqe->len = nLen;
+	sqe->user_data = userData;
+	return true;
+}
+
+int CellUring::submitAndWait(int timeoutMs) {
+	unsigned toSubmit = _sqLocalTail - *_sqTail;
+	__atomic_store_n(_sqTail, _sqLocalTail, __ATOMIC_RELEASE);
+
+	// do not block when completions are already waiting to be reaped
+	bool ready = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE) != *_cqHead;
+
+	__kernel_timespec ts = {};
+	ts.tv_sec = timeoutMs / 1000;
+	ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+
+	io_uring_getevents_arg arg = {};
+	arg.sigmask_sz = _NSIG / 8;
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+
+	int ret = io_uring_enter(_ringfd, toSubmit, ready ? 0 : 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+	if (ret < 0) {
+		// timeout or interrupted by signal is not an error
+		if (errno == ETIME || errno == EINTR || errno == EBUSY) return 0;
+		return -1;
+	}
+
+	return ret;
+}
+
+io_uring_cqe* CellUring::peekCqe() {
+	unsigned head = *_cqHead;
+	if (head == __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)) return nullptr;
+
+	return &_cqes[head & _cqMask];
+}
+
+void CellUring::seenCqe() {
+	__atomic_store_n(_cqHead, *_cqHead + 1, __ATOMIC_RELEASE);
+}
+
+char* CellUring::getBuffer(unsigned bid) {
+	return _bufs + (size_t)bid * _bufSize;
+}
+
+void CellUring::recycleBuffer(unsigned bid) {
+	unsigned short tail = _bufRing->tail;
+
+	// ring is an array of io_uring_buf whose first entry overlays tail, do not use bufs member
+	// since flexible array in kernel header is placed at wrong offset when compiled as C++
+	io_uring_buf* buf = (io_uring_buf*)_bufRing + (tail & (_nBufs - 1));
+	buf->addr = (uint64_t)(uintptr_t)getBuffer(bid);
+	buf->len = _bufSize;
+	buf->bid = (unsigned short)bid;
+
+	__atomic_store_n(&_bufRing->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+bool CellUring::isSupported() {
+	// multishot recv is available since linux 6.0
+	utsname u = {};
+	if (uname(&u) != 0) return false;
+
+	int major = 0, minor = 0;
+	if (sscanf(u.release, "%d.%d", &major, &minor) != 2 || major < 6) return false;
+
+	// io_uring may still be disabled by sysctl or seccomp
+	CellUring ring;
+	return ring.init(8, 8, 64);
+}
+
+CellUring::~CellUring() {
+	if (_sqes) munmap(_sqes, _sqesSize);
+	if (_sqPtr) munmap(_sqPtr, _sqSize);
+	if (_ringfd >= 0) close(_ringfd);
+
+	// buffers can only be released after ring is closed
+	if (_bufRing) free(_bufRing);
+	if (_bufs) free(_bufs);
+}
+
+#endif // CELL_HAS_IO_URING
@@ -0,0 +1,119 @@
+#ifndef _CELL_URING_HPP_
+#define _CELL_URING_HPP_
+
+#include "Cell.hpp"
+
+#include <stdint.h>
+
+// io_uring is only available on linux with recent kernel headers
+#if defined(__linux__) && defined(__has_include)
+#	if __has_include(<linux/io_uring.h>)
+#		include <linux/io_uring.h>
+#		ifdef IORING_RECV_MULTISHOT
+#			define CELL_HAS_IO_URING
+#		endif
+#	endif
+#endif
+
+// how child servers perform socket I/O, chosen when launching the server
+enum class CellIoEngine {
+	// readiness notification (epoll/select) followed by one recv() per ready socket
+	Reactor,
+	// completion based io_uring, falls back to reactor when kernel does not support it
+	IoUring
+};
+
+#ifdef CELL_HAS_IO_URING
+
+// minimal io_uring wrapper on top of raw system calls, one ring is owned by one thread.
+// receiving uses multishot recv with a ring of buffers registered to kernel (provided buffers),
+// so a loaded server submits requests and reaps completions of many sockets in one system call
+class CellUring {
+public:
+	CellUring();
+
+	// ring maps kernel memory and should not be copied
+	CellUring(const CellUring&) = delete;
+	void operator=(const CellUring&) = delete;
+
+	// create ring with given number of submission entries,
+	// if nBufs > 0, register nBufs receive buffers of bufSize bytes (nBufs must be power of 2)
+	// return false when kernel does not support features we need
+	bool init(unsigned entries, unsigned nBufs, unsigned bufSize);
+
+	// keep receiving from socket into registered buffers until connection is closed or error happens
+	bool prepRecvMultishot(SOCKET sock, uint64_t userData);
+
+	// keep accepting connections on listening socket
+	bool prepAcceptMultishot(SOCKET sock, uint64_t userData);
+
+	// send data from pBuf, which must not be changed or released until completion arrives
+	bool prepSend(SOCKET sock, const char* pBuf, unsigned nLen, uint64_t userData);
+
+	// cancel the request submitted with user data target, such as a multishot recv
+	bool prepCancel(uint64_t target, uint64_t userData);
+
+	// read from file descriptor into pBuf once
+	bool prepRead(int fd, void* pBuf, unsigned nLen, uint64_t userData);
+
+	// submit all queued requests and wait at most timeoutMs for at least one completion,
+	// return -1 on error
+	int submitAndWait(int timeoutMs);
+
+	// return next completion or nullptr when completion queue is empty
+	io_uring_cqe* peekCqe();
+
+	// mark the completion returned by peekCqe() as consumed
+	void seenCqe();
+
+	// address of a registered buffer selected by kernel for a recv completion
+	char* getBuffer(unsigned bid);
+
+	// give buffer back to kernel after its data has been consumed
+	void recycleBuffer(unsigned bid);
+
+	// check kernel version and try to set up a ring once
+	static bool isSupported();
+
+	~CellUring();
+
+private:
+	// get an empty submission entry, submit queued entries first if queue is full
+	io_uring_sqe* getSqe();
+
+	// file descriptor of ring
+	int _ringfd;
+
+	// submission queue
+	unsigned* _sqHead;
+	unsigned* _sqTail;
+	unsigned _sqMask;
+	unsigned _sqEntries;
+	io_uring_sqe* _sqes;
+
+	// tail of entries prepared locally but not published to kernel
+	unsigned _sqLocalTail;
+
+	// completion queue
+	unsigned* _cqHead;
+	unsigned* _cqTail;
+	unsigned _cqMask;
+	io_uring_cqe* _cqes;
+
+	// mapped ring memory
+	void* _sqPtr;
+	size_t _sqSize;
+	void* _cqPtr;
+	size_t _cqSize;
+	size_t _sqesSize;
+
+	// registered receive buffers
+	io_uring_buf_ring* _bufRing;
+	char* _bufs;
+	unsigned _nBufs;
+	unsigned _bufSize;
+};
+
+#endif // CELL_HAS_IO_URING
+
+#endif // !_CELL_URING_HPP_
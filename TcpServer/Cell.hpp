@@ -16,6 +16,8 @@
 #   include <unistd.h> // unix standard system interface
 #   include <arpa/inet.h>
 #	include <string.h>
+#	include <fcntl.h>  // file control options, used to set non-blocking mode
+#	include <errno.h>
 #   define SOCKET int
 #   define INVALID_SOCKET  (SOCKET)(~0)
 #   define SOCKET_ERROR            (-1)
@@ -27,4 +29,56 @@
 #define SEND_BUFF_SIZE RECV_BUFF_SIZE
 #endif
 
+// switch socket into non-blocking mode, which is required by edge-triggered pollers
+inline int setNonBlocking(SOCKET sock) {
+#ifdef _WIN32
+	u_long mode = 1;
+	return ioctlsocket(sock, FIONBIO, &mode);
+#else
+	int flags = fcntl(sock, F_GETFL, 0);
+	if (flags < 0) return SOCKET_ERROR;
+	return fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+// accept a pending connection as a non-blocking socket, return INVALID_SOCKET when there is none
+inline SOCKET acceptNonBlocking(SOCKET listenSock) {
+	// The accept function fills this structure with the address information of the client that is connecting.
+	sockaddr_in clientAddr = {};
+
+	// After the function call, it will be updated with the actual size of the client's address information.
+	int nAddrLen = sizeof(clientAddr);
+
+#ifdef _WIN32
+	SOCKET cSock = accept(listenSock, (sockaddr*)&clientAddr, &nAddrLen);
+	if (cSock != INVALID_SOCKET) setNonBlocking(cSock);
+#elif defined(__linux__)
+	// set flags in the same system call, socket is also not leaked into child processes
+	SOCKET cSock = accept4(listenSock, (sockaddr*)&clientAddr, (socklen_t*)&nAddrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	SOCKET cSock = accept(listenSock, (sockaddr*)&clientAddr, (socklen_t*)&nAddrLen);
+	if (cSock != INVALID_SOCKET) setNonBlocking(cSock);
+#endif
+
+	return cSock;
+}
+
+// check if the last failed socket call on a non-blocking socket has nothing more to do
+inline bool isWouldBlock() {
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+// check if the last failed socket call was interrupted by a signal and can be retried
+inline bool isInterrupted() {
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEINTR;
+#else
+	return errno == EINTR;
+#endif
+}
+
 #endif
\ No newline at end of file
@@ -1,8 +1,49 @@
 #include "ChildServer.hpp"
+#include "CELLAffinity.hpp"
+#include "MemoryMgr.hpp"
 
 #include <functional>
+#include <algorithm>
+#include <stdint.h>
 
-ChildServer::ChildServer(SOCKET sock = INVALID_SOCKET) :_sock{ sock }, _clients{}, _clients_Buffer{}, _mutex{}, _thread{}, _pNetEvent{ nullptr } {}
+// counters with a single writer need no atomic read-modify-write, readers only need to see whole values
+static void countUp(std::atomic<long long>& counter, long long n) {
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+#ifdef CELL_HAS_IO_URING
+#include <sys/eventfd.h>
+
+// size of submission queue of each child server
+#define URING_ENTRIES 1024
+
+// high bits of user data tell what a completion is for, low bits hold the socket
+#define URING_TAG_MASK 0xffffffff00000000ULL
+#define URING_TAG_SEND (1ULL << 32)
+#define URING_TAG_WAKEUP (2ULL << 32)
+#define URING_TAG_CANCEL (3ULL << 32)
+
+// number and size of receive buffers registered to kernel by each child server
+#define URING_BUF_COUNT 256
+#define URING_BUF_SIZE 16384
+#endif
+
+ChildServer::ChildServer(SOCKET sock = INVALID_SOCKET, CellPollerType pollerType = CellPollerType::Default, CellIoEngine ioEngine = CellIoEngine::Reactor) :_sock{ sock }, _listenSock{ INVALID_SOCKET }, _clients{}, _handoff{ CELL_HANDOFF_QUEUE_SIZE }, _thread{}, _poller{ CellPoller::create(pollerType) }, _events{}, _szRecv{}, _szStitch{}, _cpu{ -1 }, _sendQueue{}, _sendSocks{}, _broadcastQueue{}, _broadcastMsgs{}, _sendMutex{}, _sendConfig{}, _blockedSocks{}, _clientCount{ 0 }, _recvBytes{ 0 }, _recvMsgs{ 0 }, _acceptCount{ 0 }, _acceptWakeups{ 0 }, _migrateMutex{}, _migrateTarget{ nullptr }, _migrateMsgs{ 0 }, _migratePending{ false }, _migrateMeasuring{ false }, _migrateTime{}, _pExecutor{ nullptr }, _pNetEvent{ nullptr } {
+#ifdef CELL_HAS_IO_URING
+	_wakefd = -1;
+	_wakeValue = 0;
+
+	if (ioEngine == CellIoEngine::IoUring) {
+		_uring.reset(new CellUring());
+		_wakefd = eventfd(0, EFD_CLOEXEC);
+
+		if (_wakefd < 0 || !_uring->init(URING_ENTRIES, URING_BUF_COUNT, URING_BUF_SIZE)) {
+			std::cout << "io_uring is not available, fall back to " << _poller->name() << std::endl;
+			_uring.reset();
+		}
+	}
+#endif
+}
 
 // check if socket is creaBted
 bool ChildServer::isRun() {
@@ -13,89 +54,325 @@ bool ChildServer::isRun() {
 void ChildServer::closeSock() {
 	if (_sock == INVALID_SOCKET) return;
 
-#		ifdef _WIN32
-	// close all client sockets
-	for (auto iter : _clients) {
-		closesocket(iter.second->getSockfd());
-		// TODO: need to check if it is not nullptr and delete successfully
+	// client sockets are closed when the last reference of client is released
+	for (auto& slot : _clients) {
+		_poller->delSocket(slot.sockfd);
 	}
+	_clients.clear();
+	_blockedSocks.clear();
+	_clientCount = 0;
+
+#		ifdef _WIN32
+	// listening socket shared with main server is closed below
+	if (_listenSock != INVALID_SOCKET && _listenSock != _sock) closesocket(_listenSock);
+
 	// terminates use of the Winsock 2 DLL (Ws2_32.dll)
 	closesocket(_sock);
 	WSACleanup();
 #		else
-	for (auto iter : _clients) {
-		close(iter.second->getSockfd());
-		delete iter.second;
-	}
+	if (_listenSock != INVALID_SOCKET && _listenSock != _sock) close(_listenSock);
+
+#	ifdef CELL_HAS_IO_URING
+	if (_wakefd >= 0) close(_wakefd);
+	_wakefd = -1;
+#	endif
+
 	close(_sock);
 #		endif
-	_clients.clear();
+	_listenSock = INVALID_SOCKET;
 }
 
 // keep running to listen client message
 void ChildServer::OnRun() {
-	_clients_change = true;
+	// thread is pinned before it allocates and touches its buffers, so they come from its local numa node
+	if (_cpu >= 0 && !CellAffinity::pinThread(_cpu)) std::cout << "failed to pin child server to cpu " << _cpu << std::endl;
+
+	_szRecv.reset(new char[RECV_BUFF_SIZE]);
+	_szStitch.reset(new char[RECV_BUFF_SIZE]);
+
+#ifdef CELL_HAS_IO_URING
+	if (_uring) {
+		OnRunUring();
+		return;
+	}
+#endif
+
+	// connections arriving on our own listening socket are reported like client data
+	if (_listenSock != INVALID_SOCKET) _poller->addSocket(_listenSock);
+
 	while (isRun()) {
-		// check if buffer queue contain any connected clients
-		if (!_clients_Buffer.empty()) {
-			// lock guard will release lock automatically when reach the end of scope to deconstruct itself
-			std::lock_guard<std::mutex> _lock(_mutex);
+		// clients handed over since last iteration, poller was woken up for them
+		joinHandoffClients();
+
+		// wait at most 1 second for any client socket to become readable,
+		// only sockets which are ready are returned, so we never scan all clients,
+		// an idle server simply waits here until it is woken up for a new client,
+		// blocked clients are checked against time budget more often
+		int ret = _poller->wait(_blockedSocks.empty() ? 1000 : 100, _events);
+
+		// error happens when return value less than 0
+		if (ret < 0) {
+			std::cout << "=================" << std::endl;
+			std::cout << "Exception happens" << std::endl;
+			std::cout << "=================" << std::endl;
+			closeSock();
+			return;
+		}
 
-			for (auto client : _clients_Buffer) {
-				_clients[client->getSockfd()] = client;
+		for (auto& ev : _events) {
+			if (ev.sockfd == _listenSock) {
+				acceptClients();
+				continue;
 			}
 
-			_clients_Buffer.clear();
-			_clients_change = true;
+			CellClientTable::Slot* pSlot = _clients.find(ev.sockfd);
+
+			if (!pSlot) {
+				std::cout << "error, if (pClient != nullptr)" << std::endl;
+				continue;
+			}
+
+			// a paused client may still be reported for hang-up, its data is left in kernel buffer
+			bool readable = ev.readable && !pSlot->readPaused;
+
+			if (ev.error || (readable && RecvData(*pSlot) == -1) || (ev.writable && SendData(*pSlot) == -1)) {
+				removeClient(*pSlot);
+			}
 		}
 
-		if (_clients.empty()) {
-			// when no client connected, sleep child server
-			std::chrono::milliseconds t(1);
-			std::this_thread::sleep_for(t);
-			continue;
+		// messages queued by other threads, poller is woken up when there are any
+		sendPosted();
+
+		checkBlockedClients();
+
+		migrateClients();
+		//std::cout << "Server is idle and able to deal with other tasks" << std::endl;
+	}
+}
+
+// receive client message, solve message concatenation
+int ChildServer::RecvData(CellClientTable::Slot& slot) {
+	ClientPtr& client = slot.client;
+
+	// 5. keeping reading message from clients
+	// with edge-triggered poller, socket must be read until it has no more data,
+	// otherwise it will not be reported again
+	while (true) {
+		// receive messages into buffer of this thread, which is shared by all its clients,
+		// only an incomplete message at the end is copied into client buffer
+		int nLen = (int)recv(client->getSockfd(), _szRecv.get(), RECV_BUFF_SIZE, 0);
+
+		if (nLen < 0) {
+			if (isInterrupted()) continue;
+
+			// all data in kernel buffer has been read
+			if (isWouldBlock()) return 0;
 		}
 
-		// fd_set: a struct which can be placed sockets into a "set" for various purposes, such as testing a given socket for readability using the readfds parameter of the select function
-		fd_set fdRead;
-		//fd_set fdWrite;
-		//fd_set fdExp;
+		// increase number of received packages
+		_pNetEvent->OnNetRecv(client);
 
-		// reset the count of each set to zero
-		FD_ZERO(&fdRead);
-		//FD_ZERO(&fdWrite);
-		//FD_ZERO(&fdExp);
+		if (nLen <= 0) {
+			// connection has closed
+			//std::cout << "Client " << client->getSockfd() << " closed" << std::endl;
+			return -1;
+		}
 
-		// only update file descriptor set when client connect or exit
-		if (_clients_change) {
-			// record the maximum number of fd in all scokets
-			_maxSock = _clients.begin()->second->getSockfd();
+		countUp(_recvBytes, nLen);
+		if (ParseMsg(slot, _szRecv.get(), nLen) == -1) return -1;
 
-			for (auto iter : _clients) {
-				FD_SET(iter.second->getSockfd(), &fdRead);
-				if (_maxSock < iter.second->getSockfd()) _maxSock = iter.second->getSockfd();
-			}
+		// handlers on worker threads fall behind, reading is paused until they catch up
+		if (client->isStrandThrottled()) return SendData(slot);
+
+		// level-triggered poller reports socket again if there is still data in kernel buffer
+		if (!_poller->isEdgeTriggered()) return 0;
+	}
+}
+
+// send queued messages of client without blocking, socket is watched for writability only while data remains,
+// return -1 when connection is broken
+int ChildServer::SendData(CellClientTable::Slot& slot) {
+	int nLeft = slot.client->flushSend();
+	if (nLeft == SOCKET_ERROR) return -1;
+
+	bool paused = slot.readPaused;
+	if (checkSendQueue(slot, nLeft) == -1) return -1;
+
+	// stop watching as soon as queue is drained, otherwise poller keeps reporting writable socket
+	bool waiting = nLeft > 0;
+
+	if (waiting != slot.waitingWrite || paused != slot.readPaused) {
+		_poller->modSocket(slot.sockfd, !slot.readPaused, waiting);
+		slot.waitingWrite = waiting;
+	}
+
+	return 0;
+}
+
+// raise or clear backpressure of client by its amount of unsent data and apply byte budget,
+// return -1 when client should be disconnected
+int ChildServer::checkSendQueue(CellClientTable::Slot& slot, size_t nQueued) {
+	ClientPtr& client = slot.client;
+
+	if (client->takeSendOverflow() && _sendConfig.policy == CellSlowClientPolicy::Disconnect) {
+		std::cout << "Client " << client->getSockfd() << " exceeds send budget of " << _sendConfig.maxBytes << " bytes" << std::endl;
+		return -1;
+	}
+
+	if (!slot.writeBlocked && nQueued >= _sendConfig.highWatermark) {
+		slot.writeBlocked = true;
+		client->updateBlockedTime();
+		_blockedSocks.push_back(slot.sockfd);
+
+		if (_pNetEvent) _pNetEvent->OnWriteBlocked(this, client);
+	}
+	else if (slot.writeBlocked && nQueued <= _sendConfig.lowWatermark) {
+		slot.writeBlocked = false;
+		_blockedSocks.erase(std::find(_blockedSocks.begin(), _blockedSocks.end(), slot.sockfd));
+
+		if (client->isDropSend()) client->setDropSend(false);
+
+		if (_pNetEvent) _pNetEvent->OnWriteDrained(this, client);
+	}
 
-			// back up an new file descriptor set
-			memcpy(&_fdRead_pre, &fdRead, sizeof(fd_set));
-			_clients_change = false;
+	// caller stops receiving from socket while client cannot take more responses (PauseReads policy),
+	// or while workers have not caught up with its messages
+	bool pauseForSend = slot.writeBlocked && _sendConfig.policy == CellSlowClientPolicy::PauseReads;
+	slot.readPaused = pauseForSend || client->isStrandThrottled();
+
+	return 0;
+}
+
+// apply time budget to clients whose unsent data stays above high watermark
+void ChildServer::checkBlockedClients() {
+	// list shrinks when a client is removed, so index only moves forward for clients kept
+	for (size_t n = 0; n < _blockedSocks.size();) {
+		CellClientTable::Slot& slot = *_clients.find(_blockedSocks[n]);
+		ClientPtr& client = slot.client;
+
+		if (client->getBlockedTime() < _sendConfig.maxBlockedMs) {
+			n++;
+			continue;
 		}
-		else {
-			memcpy(&fdRead, &_fdRead_pre, sizeof(fd_set));
+
+		if (_sendConfig.policy == CellSlowClientPolicy::Drop) {
+			// new messages are dropped until queue drains to low watermark
+			if (!client->isDropSend()) client->setDropSend(true);
+			n++;
+			continue;
 		}
 
-		// fisrt arg: ignore, the nfds parameter is included only for compatibility with Berkeley sockets, to present to largest file descriptor number.
-		// last arg is timeout: The maximum time for select to wait for checking status of sockets
-		// allow a program to monitor multiple file descriptors, waiting until one or more of the file descriptors become "ready" for some class of I/O operation
-		// when select find status of sockets change, it would clear all sockets and reload the sockets which has changed the status
-		timeval t = { 1, 0 };
+		std::cout << "Client " << client->getSockfd() << " has not drained its data for " << _sendConfig.maxBlockedMs << " ms" << std::endl;
+		removeClient(slot);
+	}
+}
 
-		int ret = select(_maxSock + 1, &fdRead, nullptr, nullptr, &t);
+// process received data, the incomplete message left in client buffer by previous data is completed first,
+// return -1 when client sends a malformed message
+int ChildServer::ParseMsg(CellClientTable::Slot& slot, const char* pData, int nLen) {
+	CellRingBuffer& recvBuf = slot.client->getRecvBuf();
 
-		if (ret == 0) continue;
+	while (recvBuf.size() > 0 && nLen > 0) {
+		// bytes needed to complete header, and then to complete the whole message
+		size_t nWant = sizeof(DataHeader);
 
-		// error happens when return value less than 0
-		if (ret < 0) {
+		if (recvBuf.size() >= sizeof(DataHeader)) {
+			DataHeader header;
+			recvBuf.copyOut(&header, sizeof(DataHeader));
+			nWant = header.length;
+		}
+
+		// only copy the missing part of the message
+		int nCopy = nWant - recvBuf.size() < (size_t)nLen ? (int)(nWant - recvBuf.size()) : nLen;
+		if (!recvBuf.write(pData, nCopy)) return -1;
+
+		pData += nCopy;
+		nLen -= nCopy;
+
+		if (ParseMsg(slot) == -1) return -1;
+	}
+
+	// receive at least one full dataheader, 
+	// repeatedly process the incoming message, which solve packet concatenation
+	while (nLen >= (int)sizeof(DataHeader)) {
+		// data may not be aligned for DataHeader
+		DataHeader header;
+		memcpy(&header, pData, sizeof(DataHeader));
+
+		// a length shorter than header would never be consumed
+		if (header.length < (short)sizeof(DataHeader)) return -1;
+
+		// the remaining message is not complete, wait until we get a full next message
+		if (nLen < header.length) break;
+
+		// get a complete message and response with client,
+		// message is read in place and handler must retain() it to keep it
+		slot.recvMsgs++;
+		OnNetMsg(slot.client, MessageView(alignMsg(pData, header.length)));
+
+		pData += header.length;
+		nLen -= header.length;
+	}
+
+	// keep incomplete message in client buffer until the rest of it arrives
+	if (!recvBuf.write(pData, nLen)) return -1;
+
+	return 0;
+}
+
+// process the complete message assembled in client buffer,
+// return -1 when client sends a malformed message
+int ChildServer::ParseMsg(CellClientTable::Slot& slot) {
+	CellRingBuffer& recvBuf = slot.client->getRecvBuf();
+
+	while (recvBuf.size() >= sizeof(DataHeader)) {
+		// header itself may wrap around the end of buffer
+		DataHeader header;
+		recvBuf.copyOut(&header, sizeof(DataHeader));
+
+		// a length shorter than header would never be consumed
+		if (header.length < (short)sizeof(DataHeader)) return -1;
+
+		// the remaining message is not complete, wait until we get a full next message
+		if (recvBuf.size() < (size_t)header.length) break;
+
+		// message is read in place (or from stitch buffer when it wraps) and handler must retain() it to keep it
+		const char* pMsg = recvBuf.peek(header.length, _szStitch.get());
+		slot.recvMsgs++;
+		OnNetMsg(slot.client, MessageView(alignMsg(pMsg, header.length)));
+
+		// buffer goes back to pool when it becomes empty
+		recvBuf.consume(header.length);
+	}
+
+	return 0;
+}
+
+// message read in place when it is aligned, otherwise copied to stitch buffer first
+const DataHeader* ChildServer::alignMsg(const char* pMsg, size_t nLen) {
+	// a message stitched together is already at the start of stitch buffer
+	if ((uintptr_t)pMsg % MESSAGE_ALIGN == 0) return (const DataHeader*)pMsg;
+
+	memcpy(_szStitch.get(), pMsg, nLen);
+	return (const DataHeader*)_szStitch.get();
+}
+
+#ifdef CELL_HAS_IO_URING
+void ChildServer::OnRunUring() {
+	if (_listenSock != INVALID_SOCKET) _uring->prepAcceptMultishot(_listenSock, (uint64_t)_listenSock);
+
+	// other threads write eventfd to interrupt waiting for completions
+	_uring->prepRead(_wakefd, &_wakeValue, sizeof(_wakeValue), URING_TAG_WAKEUP);
+
+	while (isRun()) {
+		// clients handed over since last iteration, ring was woken up for them
+		joinHandoffClients();
+
+		// submit new requests and reap completions of all sockets in one system call,
+		// an idle server waits here until it is woken up for a new client,
+		// blocked clients are checked against time budget more often
+		int timeoutMs = _blockedSocks.empty() ? 1000 : 100;
+		if (_uring->submitAndWait(timeoutMs) < 0) {
 			std::cout << "=================" << std::endl;
 			std::cout << "Exception happens" << std::endl;
 			std::cout << "=================" << std::endl;
@@ -103,117 +380,211 @@ void ChildServer::OnRun() {
 			return;
 		}
 
-#				ifdef _WIN32
-		// loop through all client sockets to process command
-		for (int n = 0; n < fdRead.fd_count; n++) {
-			// fd array is a socket array in windows, while in unix it is a bitmask
-			auto iter = _clients.find(fdRead.fd_array[n]);
+		// connections accepted in this wakeup
+		int nAccepts = 0;
 
-			if (FD_ISSET(iter->second->getSockfd(), &fdRead)) {
-				if (iter != _clients.end()) {
-					if (RecvData(iter->second) == -1) {
-						if (_pNetEvent) _pNetEvent->OnExit(iter->second);
-						std::cout << "Client " << iter->second->getSockfd() << " exit" << std::endl;
+		// completions keep arriving while they are reaped under load, so only a bounded number is
+		// handled before new requests (such as cancels of paused clients) are submitted
+		for (int nCqe = 0; nCqe < URING_ENTRIES; nCqe++) {
+			io_uring_cqe* cqe = _uring->peekCqe();
+			if (!cqe) break;
 
-						_clients_change = true;
-						_clients.erase(iter->first);
-					}
-				}
-				else {
-					std::cout << "error, if (iter != _clients.end())" << std::endl;
-				}
+			uint64_t tag = cqe->user_data & URING_TAG_MASK;
+			SOCKET sockfd = (SOCKET)(cqe->user_data & ~URING_TAG_MASK);
+			int res = cqe->res;
+			unsigned flags = cqe->flags;
+			_uring->seenCqe();
+
+			if (tag == URING_TAG_WAKEUP) {
+				_uring->prepRead(_wakefd, &_wakeValue, sizeof(_wakeValue), URING_TAG_WAKEUP);
+				continue;
 			}
-		}
 
-#				else
-		std::vector<ClientPtr> temp;
-		for (auto iter : _clients) {
-			if (FD_ISSET(iter.second->getSockfd(), &fdRead)) {
-				if (RecvData(iter.second) == -1) {
-					if (_pNetEvent) _pNetEvent->OnExit(iter.second);
-					std::cout << "Client " << iter.second->getSockfd() << " exit" << std::endl;
+			// result of cancelling a recv, the recv itself completes separately
+			if (tag == URING_TAG_CANCEL) continue;
+
+			if (tag == URING_TAG_SEND) {
+				CellClientTable::Slot* pSending = _uringSends.find(sockfd);
+				if (!pSending) continue;
+
+				ClientPtr client = std::move(pSending->client);
+				_uringSends.erase(sockfd);
+
+				// client has exited while its data was being sent
+				CellClientTable::Slot* pSlot = _clients.find(sockfd);
+				if (!pSlot || pSlot->client != client) continue;
+
+				pSlot->waitingWrite = false;
 
-					_clients_change = true;
-					temp.push_back(iter.second);
+				// broken connection is dropped when its recv completes with error
+				if (res < 0) continue;
+
+				// send what is left of a partial send and messages queued in the meantime
+				client->sendDone(res);
+				if (SendDataUring(*pSlot) == -1) removeClient(*pSlot);
+				continue;
+			}
+
+			// new connection on our own listening socket
+			if (sockfd == _listenSock) {
+				if (res >= 0) {
+					ClientPtr c = Client::createShared(res);
+					if (_pNetEvent) _pNetEvent->OnJoin(c);
+					joinClient(c);
+					nAccepts++;
 				}
+
+				// multishot accept is terminated by kernel, start it again
+				if (!(flags & IORING_CQE_F_MORE)) _uring->prepAcceptMultishot(_listenSock, (uint64_t)_listenSock);
+				continue;
 			}
-		}
 
-		for (auto client : temp) {
-			_clients.erase(client->sockfd());
-			delete client;
-		}
-# 				endif
-		//std::cout << "Server is idle and able to deal with other tasks" << std::endl;
-	}
-}
+			CellClientTable::Slot* pSlot = _clients.find(sockfd);
 
-// receive client message, solve message concatenation
-int ChildServer::RecvData(ClientPtr& client) {
-	// 5. keeping reading message from clients
-	// we only read header info from the incoming message
+			// recv stays in flight as long as kernel sets this flag, even when client is dropped below
+			bool more = flags & IORING_CQE_F_MORE;
 
-	// pointer points to the client buffer
-	char* _szRecv = client->getMsgBuf() + client->getOffset();
+			if (flags & IORING_CQE_F_BUFFER) {
+				unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
 
-	// receive messages from clients and store into buffer
-	int nLen = (int)recv(client->getSockfd(), _szRecv, (RECV_BUFF_SIZE)-client->getOffset(), 0);
+				if (pSlot && res > 0) {
+					ClientPtr& client = pSlot->client;
 
-	// increase number of received packages
-	_pNetEvent->OnNetRecv(client);
+					// increase number of received packages
+					_pNetEvent->OnNetRecv(client);
+					countUp(_recvBytes, res);
 
-	if (nLen <= 0) {
-		// connection has closed
-		//std::cout << "Client " << client->getSockfd() << " closed" << std::endl;
-		return -1;
-	}
+					// messages are processed directly in registered buffer, so that it can be reused by kernel immediately,
+					// malformed message, stop receiving and drop client below
+					if (ParseMsg(*pSlot, _uring->getBuffer(bid), res) == -1) {
+						res = -EPROTO;
+						flags &= ~IORING_CQE_F_MORE;
+					}
+					// handlers on worker threads fall behind, recv is cancelled until they catch up
+					else if (client->isStrandThrottled() && !pSlot->readPaused && SendDataUring(*pSlot) == -1) {
+						res = -EPROTO;
+						flags &= ~IORING_CQE_F_MORE;
+					}
+				}
 
-	// increase offset so that the next message will be moved to the end of the previous message
-	// TODO: reconsider the value to set
-	client->setOffset(client->getOffset() + nLen);
+				_uring->recycleBuffer(bid);
+			}
 
-	// receive at least one full dataheader, 
-	// repeatedly process the incoming message, which solve packet concatenation
+			if (!more) {
+				if (pSlot) pSlot->recvPending = false;
+				// last completion of a removed client, its socket can be closed now
+				else _uringClosing.erase(sockfd);
+			}
+
+			if (!pSlot || (flags & IORING_CQE_F_MORE)) continue;
+
+			// multishot recv stops when it is cancelled for paused reading or registered buffers run out,
+			// it is started again unless reading is (still) paused
+			if (res == -ECANCELED || res == -ENOBUFS) {
+				if (!pSlot->readPaused) {
+					_uring->prepRecvMultishot(sockfd, (uint64_t)sockfd);
+					pSlot->recvPending = true;
+				}
+				continue;
+			}
+
+			// connection has closed or error happens
+			removeClient(*pSlot);
+		}
 
-	while (client->getOffset() >= sizeof(DataHeader)) {
-		DataHeader* ptr = (DataHeader*)client->getMsgBuf();
-		DataHeaderPtr header = std::make_shared<DataHeader>(*ptr);
+		countAccepts(nAccepts);
 
-		// receive a full message including data header
-		if (client->getOffset() >= header->length) {
+		// messages queued by other threads, ring is woken up when there are any
+		sendPosted();
 
-			// the length of all following messages
-			int shiftLen = client->getOffset() - header->length;
+		checkBlockedClients();
+	}
+}
 
-			// get a complete message and response with client 
-			OnNetMsg(client, header);
+// submit send of queued messages, at most one send of a client is in flight,
+// return -1 when client should be disconnected
+int ChildServer::SendDataUring(CellClientTable::Slot& slot) {
+	ClientPtr& client = slot.client;
+	SOCKET sockfd = slot.sockfd;
 
-			// successfully processs the first message
-			// shift all following messages to the beginning of buffer
-			memcpy(client->getMsgBuf(), client->getMsgBuf() + header->length, shiftLen);
+	bool paused = slot.readPaused;
+	if (checkSendQueue(slot, client->getSendSize()) == -1) return -1;
 
-			client->setOffset(shiftLen);
+	if (paused != slot.readPaused) {
+		// multishot recv keeps delivering data, so it is cancelled while reading is paused,
+		// a recv which is still being cancelled is started again when its last completion arrives
+		if (slot.readPaused) {
+			if (slot.recvPending) _uring->prepCancel((uint64_t)sockfd, URING_TAG_CANCEL | (uint64_t)sockfd);
 		}
-		else {
-			// the remaining message is not complete, wait until we get a full next message
-			break;
+		else if (!slot.recvPending) {
+			_uring->prepRecvMultishot(sockfd, (uint64_t)sockfd);
+			slot.recvPending = true;
 		}
 	}
 
+	// the next send is submitted when current one completes, so data is sent in order
+	if (slot.waitingWrite) return 0;
+
+	int nLen = 0;
+	const char* pData = client->getSendData(nLen);
+	if (nLen == 0) return 0;
+
+	if (!_uring->prepSend(sockfd, pData, nLen, URING_TAG_SEND | (uint64_t)sockfd)) {
+		// submission queue is full, try again in next iteration, which must not wait for a completion
+		{
+			std::lock_guard<std::mutex> lock(_sendMutex);
+			_sendQueue.push_back(sockfd);
+		}
+
+		wakeup();
+		return 0;
+	}
+
+	slot.waitingWrite = true;
+	_uringSends.insert(client);
 	return 0;
 }
+#endif
 
 // response client message, there can be different ways of processing messages in different kinds of server
 // we use virutal to for inheritance
-void ChildServer::OnNetMsg(ClientPtr client, DataHeaderPtr header) {
+void ChildServer::OnNetMsg(ClientPtr& client, const MessageView& msg) {
+	countUp(_recvMsgs, 1);
+
+	if (_pExecutor) {
+		CellStrandPtr& strand = client->getStrand(_pExecutor);
+
+		// message is copied since receive buffer is reused as soon as we return,
+		// strand keeps messages of one client in order while clients run in parallel
+		if (!strand->isIdle() || !_pNetEvent->isInlineMsg(this, client, msg)) {
+			strand->post(std::allocate_shared<CellNetMsgTask>(MemoryAllocator<CellNetMsgTask>(), _pNetEvent, this, client, msg.retain()));
+			return;
+		}
+	}
+
 	// increase the count of received message
-	_pNetEvent->OnNetMsg(this, client, header);
+	_pNetEvent->OnNetMsg(this, client, msg);
 }
 
-// add client from main thread into the buffer queue of child thread
-void ChildServer::addClient(ClientPtr client) {
-	std::lock_guard<std::mutex> lock(_mutex);
-	_clients_Buffer.push_back(client);
+// hand client over to this server from any thread, event loop is woken up to take it at once,
+// a caller handing over several clients can wake it up only once with wakeup()
+void ChildServer::addClient(ClientPtr client, bool wake) {
+	// event loop empties queue every iteration, it only fills up under a burst of connections
+	while (!_handoff.push(std::move(client))) {
+		wakeup();
+		std::this_thread::yield();
+	}
+
+	if (wake) wakeup();
+}
+
+// register clients handed over by other threads
+void ChildServer::joinHandoffClients() {
+	ClientPtr client;
+
+	while (_handoff.pop(client)) {
+		joinClient(client);
+	}
 }
 
 void ChildServer::start() {
@@ -221,23 +592,363 @@ void ChildServer::start() {
 	// start an thread for child server, to listen and process client message
 	_thread = std::thread(std::bind(&ChildServer::OnRun,this));
 	_thread.detach();
+}
 
-	// start task server to reponse messages
-	_taskServer.start();
+// limits of unsent data of each client and what to do with clients exceeding them, must be called before start()
+void ChildServer::setSendConfig(const CellSendConfig& config) {
+	_sendConfig = config;
 }
 
+const CellSendConfig& ChildServer::getSendConfig() {
+	return _sendConfig;
+}
+
+// run handlers on worker threads of executor instead of this thread, must be called before start()
+void ChildServer::setExecutor(CellExecutor* pExecutor) {
+	_pExecutor = pExecutor;
+}
+
+// pin thread of this server to cpu, -1 to leave it to scheduler, must be called before start()
+void ChildServer::setCpu(int cpu) {
+	_cpu = cpu;
+}
+
+// number of clients served and waiting to be taken, called by any thread
 size_t ChildServer::getCount() {
-	return _clients.size() + _clients_Buffer.size();
+	return _clientCount.load(std::memory_order_relaxed) + _handoff.size();
+}
+
+// bytes and messages received since start, called by any thread
+long long ChildServer::getRecvBytes() {
+	return _recvBytes.load(std::memory_order_relaxed);
+}
+
+long long ChildServer::getRecvMsgs() {
+	return _recvMsgs.load(std::memory_order_relaxed);
+}
+
+// connections accepted on own listening socket and wakeups which accepted them since last call,
+// called by any thread
+void ChildServer::takeAcceptStats(int& nAccepts, int& nWakeups) {
+	nAccepts = _acceptCount.exchange(0);
+	nWakeups = _acceptWakeups.exchange(0);
 }
 
 void ChildServer::setMainServer(INetEvent* event) {
 	_pNetEvent = event;
 }
 
-void ChildServer::addSendTask(ClientPtr clientSock, DataHeaderPtr header) {
-	CellTaskPtr task = std::make_shared<CellSendMsgToClientTask>(clientSock, header);
+// let child server accept connections on its own listening socket (SO_REUSEPORT),
+// instead of receiving them from main thread, must be called before start()
+void ChildServer::setListenSock(SOCKET sock) {
+	_listenSock = sock;
+
+	// accept until there is no pending connection, without blocking event loop
+	setNonBlocking(_listenSock);
+}
+
+// register client into poller (or io_uring) and client list of this thread
+void ChildServer::joinClient(ClientPtr& client) {
+#ifdef CELL_HAS_IO_URING
+	if (_uring) {
+		// socket fd is used to find client when its data arrives
+		CellClientTable::Slot& slot = _clients.insert(client);
+		_clientCount++;
+		_uring->prepRecvMultishot(slot.sockfd, (uint64_t)slot.sockfd);
+		slot.recvPending = true;
+
+		// messages may have been queued before client joined this thread
+		client->setOwner(this);
+		SendDataUring(slot);
+		return;
+	}
+#endif
+
+	// edge-triggered poller requires draining socket until it would block,
+	// and sends never block the event loop
+	setNonBlocking(client->getSockfd());
+
+	if (!_poller->addSocket(client->getSockfd())) {
+		std::cout << "Client " << client->getSockfd() << " rejected, " << _poller->name() << " cannot monitor more sockets" << std::endl;
+		if (_pNetEvent) _pNetEvent->OnExit(client);
+		return;
+	}
+
+	CellClientTable::Slot& slot = _clients.insert(client);
+	_clientCount++;
+
+	// messages may have been queued before client joined this thread
+	client->setOwner(this);
+	SendData(slot);
+}
+
+// accept all pending connections on listening socket of this child server
+void ChildServer::acceptClients() {
+	int nAccepts = 0;
+
+	while (true) {
+		SOCKET cSock = acceptNonBlocking(_listenSock);
+
+		if (INVALID_SOCKET == cSock) {
+			if (isInterrupted()) continue;
+
+			// no more pending connection
+			if (!isWouldBlock()) std::cout << "ERROR:Invalid Socket " << _listenSock << " accepted" << std::endl;
+			break;
+		}
+
+		// connection is served by the thread which accepted it, no hand-off is needed
+		ClientPtr c = Client::createShared(cSock);
+		if (_pNetEvent) _pNetEvent->OnJoin(c);
+		joinClient(c);
+		nAccepts++;
+	}
+
+	countAccepts(nAccepts);
+}
+
+// count accepts of one wakeup of event loop, to show how well they are batched
+void ChildServer::countAccepts(int nAccepts) {
+	if (nAccepts == 0) return;
+
+	_acceptCount += nAccepts;
+	_acceptWakeups++;
+}
+
+// remove client from this thread, its socket is closed when the last reference is released,
+// slot is released here, so it must not be used afterwards
+void ChildServer::removeClient(CellClientTable::Slot& slot) {
+	ClientPtr client = slot.client;
+	SOCKET sockfd = slot.sockfd;
+	bool blocked = slot.writeBlocked;
+
+#ifdef CELL_HAS_IO_URING
+	if (_uring) {
+		// cancelling only queues a request, completions of client keep arriving after it is removed.
+		// a send in flight holds a reference in send table until it completes, a recv in flight holds one
+		// in closing table, so socket fd is not reused before kernel has released it.
+		// a send to a client which does not read never completes unless it is cancelled
+		if (slot.recvPending) {
+			_uring->prepCancel((uint64_t)sockfd, URING_TAG_CANCEL | (uint64_t)sockfd);
+			_uringClosing.insert(client);
+		}
+		if (slot.waitingWrite) _uring->prepCancel(URING_TAG_SEND | (uint64_t)sockfd, URING_TAG_CANCEL | (uint64_t)sockfd);
+	}
+	else
+#endif
+	_poller->delSocket(sockfd);
+
+	_clients.erase(sockfd);
+	_clientCount--;
+
+	if (blocked) _blockedSocks.erase(std::find(_blockedSocks.begin(), _blockedSocks.end(), sockfd));
+
+	// messages sent to client from now on are dropped together with it
+	client->setOwner(nullptr);
+
+	// every blocked client is reported drained once, even when it leaves without draining
+	if (blocked && _pNetEvent) _pNetEvent->OnWriteDrained(this, client);
+
+	if (_pNetEvent) _pNetEvent->OnExit(client);
+	std::cout << "Client " << sockfd << " exit" << std::endl;
+}
+
+// move clients receiving about msgsPerSec messages in total to target, called by any thread,
+// clients are moved by thread of this server in its next iteration, not supported by io_uring engine
+void ChildServer::requestMigration(ChildServer* target, double msgsPerSec) {
+	{
+		std::lock_guard<std::mutex> lock(_migrateMutex);
+		_migrateTarget = target;
+		_migrateMsgs = msgsPerSec;
+	}
+
+	_migratePending = true;
+	wakeup();
+}
+
+// move clients asked for by requestMigration()
+void ChildServer::migrateClients() {
+	if (!_migratePending) return;
+
+	// clients are only compared by messages received after request, over at least one second
+	if (!_migrateMeasuring) {
+		for (auto& slot : _clients) {
+			slot.recvMsgs = 0;
+		}
+
+		_migrateTime.update();
+		_migrateMeasuring = true;
+		return;
+	}
+
+	double t = _migrateTime.getElapsedSecond();
+	if (t < 1.0) return;
+
+	_migrateMeasuring = false;
+	_migratePending = false;
+
+	ChildServer* target = nullptr;
+	double msgsLeft = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(_migrateMutex);
+		target = _migrateTarget;
+		msgsLeft = _migrateMsgs;
+	}
+
+	if (!target || target == this) return;
+
+	// message rate of every client, clients whose state is tied to this thread stay here:
+	// data waiting for writability, paused reading or a backlog on worker threads
+	std::vector<std::pair<double, SOCKET>> rates;
+
+	for (auto& slot : _clients) {
+		double rate = slot.recvMsgs / t;
+		slot.recvMsgs = 0;
+
+		// client is only dereferenced when none of the states kept in its slot holds it here
+		if (rate <= 0 || slot.waitingWrite || slot.writeBlocked || slot.readPaused || slot.client->isStrandThrottled()) continue;
+
+		rates.push_back(std::make_pair(rate, slot.sockfd));
+	}
+
+	// busiest clients go first, so few clients are moved. moving a client only narrows the gap
+	// when its rate is below twice what is left to move, otherwise hot spot would just move to target
+	std::sort(rates.begin(), rates.end(), [](const std::pair<double, SOCKET>& a, const std::pair<double, SOCKET>& b) { return a.first > b.first; });
+
+	int nMoved = 0;
+
+	for (auto& rate : rates) {
+		if (rate.first >= msgsLeft * 2) continue;
+
+		ClientPtr client = _clients.find(rate.second)->client;
+
+		// stop reading here before target starts, so no data is read twice or out of order,
+		// an incomplete message in receive buffer and unsent messages travel with client
+		_poller->delSocket(rate.second);
+		_clients.erase(rate.second);
+		_clientCount--;
+
+		// messages sent meanwhile are queued and sent by target when it takes client
+		client->setOwner(nullptr);
+
+		if (_pNetEvent) _pNetEvent->OnMigrate(this, target, client);
+		target->addClient(client, false);
+
+		msgsLeft -= rate.first;
+		nMoved++;
+	}
+
+	if (nMoved > 0) target->wakeup();
+}
+
+// send messages of clients posted by other threads since last iteration
+void ChildServer::sendPosted() {
+	{
+		std::lock_guard<std::mutex> lock(_sendMutex);
+		if (_sendQueue.empty() && _broadcastQueue.empty()) return;
+
+		_sendSocks.swap(_sendQueue);
+		_broadcastMsgs.swap(_broadcastQueue);
+	}
+
+	if (!_broadcastMsgs.empty()) sendBroadcasts();
+
+	for (auto sockfd : _sendSocks) {
+		CellClientTable::Slot* pSlot = _clients.find(sockfd);
+
+		// client has exited after posting
+		if (!pSlot) continue;
+
+#ifdef CELL_HAS_IO_URING
+		if (_uring) {
+			if (SendDataUring(*pSlot) == -1) removeClient(*pSlot);
+			continue;
+		}
+#endif
+
+		if (SendData(*pSlot) == -1) removeClient(*pSlot);
+	}
+
+	_sendSocks.clear();
+}
+
+// queue broadcast messages taken by sendPosted() to all clients, then send to each of them once
+void ChildServer::sendBroadcasts() {
+	// messages are only appended here, clients are sent to once below instead of being posted one by one
+	for (auto& msg : _broadcastMsgs) {
+		for (auto& slot : _clients) {
+			slot.client->queueMessage(msg);
+		}
+	}
+
+	// last reference of a message releases its block
+	_broadcastMsgs.clear();
+
+	// removing a client moves the last one into its position, which has been sent to already
+	for (size_t n = _clients.size(); n-- > 0;) {
+		CellClientTable::Slot& slot = _clients.at(n);
+
+#ifdef CELL_HAS_IO_URING
+		if (_uring) {
+			if (SendDataUring(slot) == -1) removeClient(slot);
+			continue;
+		}
+#endif
+
+		if (SendData(slot) == -1) removeClient(slot);
+	}
+}
+
+// called by a client of this server from any thread when its send queue becomes non-empty,
+// messages are then sent by the thread of this server
+void ChildServer::postSend(SOCKET sock) {
+	bool wake = false;
+
+	{
+		std::lock_guard<std::mutex> lock(_sendMutex);
+
+		// event loop has not taken queues yet, it has been woken up already
+		wake = _sendQueue.empty() && _broadcastQueue.empty();
+		_sendQueue.push_back(sock);
+	}
+
+	if (wake) wakeup();
+}
+
+// interrupt waiting of event loop
+void ChildServer::wakeup() {
+#ifdef CELL_HAS_IO_URING
+	if (_uring) {
+		eventfd_write(_wakefd, 1);
+		return;
+	}
+#endif
+
+	_poller->wakeup();
+}
+
+// queue message to client, it is sent by the thread of this server without blocking
+void ChildServer::addSendTask(ClientPtr clientSock, const MsgBuf& msg) {
+	// appending to send buffer never blocks, so there is no need to hand message to another thread,
+	// where messages of one flooding client would delay responses of all others
+	clientSock->sendMessage(msg);
+}
+
+// queue message to all clients of this server, called by any thread. thread of this server
+// appends it to the send queue of every client in its next iteration and sends them together
+void ChildServer::addBroadcast(const MsgBuf& msg) {
+	bool wake = false;
+
+	{
+		std::lock_guard<std::mutex> lock(_sendMutex);
+
+		// message is shared with other servers, only its reference count changes
+		wake = _sendQueue.empty() && _broadcastQueue.empty();
+		_broadcastQueue.push_back(msg);
+	}
 
-	_taskServer.addTask(task);
+	if (wake) wakeup();
 }
 
 ChildServer::~ChildServer() {
@@ -4,18 +4,27 @@
 #include "Cell.hpp"
 #include "Client.hpp"
 #include "CELLTask.hpp"
+#include "CELLExecutor.hpp"
 #include "INetEvent.hpp"
+#include "CELLPoller.hpp"
+#include "CELLUring.hpp"
+#include "CELLClientTable.hpp"
+#include "CELLQueue.hpp"
+#include "CELLTimestamp.hpp"
 
-#include <map>
 #include <vector>
 #include <thread>
 
+// number of clients which can wait to be taken by a child server, must be power of 2
+#ifndef CELL_HANDOFF_QUEUE_SIZE
+#define CELL_HANDOFF_QUEUE_SIZE 1024
+#endif
+
 class ChildServer {
 public:
 	using CellTaskPtr = std::shared_ptr<CellTask>;
-	using CellSendMsgToClientTaskptr = std::shared_ptr<CellSendMsgToClientTask>;
 
-	ChildServer(SOCKET sock);
+	ChildServer(SOCKET sock, CellPollerType pollerType, CellIoEngine ioEngine);
 
 	// check if socket is creaBted
 	bool isRun();
@@ -27,58 +36,220 @@ public:
 	void OnRun();
 
 	// receive client message, solve message concatenation
-	int RecvData(ClientPtr& client);
+	// return -1 when client exits
+	int RecvData(CellClientTable::Slot& slot);
+
+	// send queued messages of client without blocking, socket is watched for writability only while data remains,
+	// return -1 when connection is broken
+	int SendData(CellClientTable::Slot& slot);
+
+	// process received data, the incomplete message left in client buffer by previous data is completed first,
+	// return -1 when client sends a malformed message
+	int ParseMsg(CellClientTable::Slot& slot, const char* pData, int nLen);
+
+	// process the complete message assembled in client buffer,
+	// return -1 when client sends a malformed message
+	int ParseMsg(CellClientTable::Slot& slot);
 
 	// response client message, there can be different ways of processing messages in different kinds of server
 	// we use virutal to for inheritance
-	virtual void OnNetMsg(ClientPtr client, DataHeaderPtr header);
+	virtual void OnNetMsg(ClientPtr& client, const MessageView& msg);
 
-	// add client from main thread into the buffer queue of child thread
-	void addClient(ClientPtr client);
+	// hand client over to this server from any thread, event loop is woken up to take it at once,
+	// a caller handing over several clients can wake it up only once with wakeup()
+	void addClient(ClientPtr client, bool wake = true);
+
+	// interrupt waiting of event loop
+	void wakeup();
 
 	void start();
 
+	// number of clients served and waiting to be taken, called by any thread
 	size_t getCount();
 
+	// bytes and messages received since start, called by any thread
+	long long getRecvBytes();
+	long long getRecvMsgs();
+
+	// connections accepted on own listening socket and wakeups which accepted them since last call,
+	// called by any thread
+	void takeAcceptStats(int& nAccepts, int& nWakeups);
+
 	void setMainServer(INetEvent* event);
 
-	void addSendTask(ClientPtr clientSock, DataHeaderPtr header);
+	// let child server accept connections on its own listening socket (SO_REUSEPORT),
+	// instead of receiving them from main thread, must be called before start()
+	void setListenSock(SOCKET sock);
+
+	// queue message to client, it is sent by the thread of this server without blocking
+	void addSendTask(ClientPtr clientSock, const MsgBuf& msg);
+
+	// queue message to all clients of this server, called by any thread. thread of this server
+	// appends it to the send queue of every client in its next iteration and sends them together
+	void addBroadcast(const MsgBuf& msg);
+
+	// limits of unsent data of each client and what to do with clients exceeding them, must be called before start()
+	void setSendConfig(const CellSendConfig& config);
+
+	const CellSendConfig& getSendConfig();
+
+	// run handlers on worker threads of executor instead of this thread, must be called before start()
+	void setExecutor(CellExecutor* pExecutor);
+
+	// pin thread of this server to cpu, -1 to leave it to scheduler, must be called before start()
+	void setCpu(int cpu);
+
+	// move clients receiving about msgsPerSec messages in total to target, called by any thread,
+	// clients are moved by thread of this server in its next iteration, not supported by io_uring engine
+	void requestMigration(ChildServer* target, double msgsPerSec);
+
+	// called by a client of this server from any thread when its send queue becomes non-empty,
+	// messages are then sent by the thread of this server
+	void postSend(SOCKET sock);
 
 	~ChildServer();
 
 private:
+	// register client into poller (or io_uring) and client list of this thread
+	void joinClient(ClientPtr& client);
+
+	// accept all pending connections on listening socket of this child server
+	void acceptClients();
+
+	// count accepts of one wakeup of event loop, to show how well they are batched
+	void countAccepts(int nAccepts);
+
+	// register clients handed over by other threads
+	void joinHandoffClients();
+
+
+	// remove client from this thread, its socket is closed when the last reference is released,
+	// slot is released here, so it must not be used afterwards
+	void removeClient(CellClientTable::Slot& slot);
+
+	// message read in place when it is aligned, otherwise copied to stitch buffer first
+	const DataHeader* alignMsg(const char* pMsg, size_t nLen);
+
+	// send messages of clients posted by other threads since last iteration
+	void sendPosted();
+
+	// queue broadcast messages taken by sendPosted() to all clients, then send to each of them once
+	void sendBroadcasts();
+
+	// raise or clear backpressure of client by its amount of unsent data and apply byte budget,
+	// return -1 when client should be disconnected
+	int checkSendQueue(CellClientTable::Slot& slot, size_t nQueued);
+
+	// apply time budget to clients whose unsent data stays above high watermark
+	void checkBlockedClients();
+
+	// move clients asked for by requestMigration()
+	void migrateClients();
+
+#ifdef CELL_HAS_IO_URING
+	// event loop of io_uring engine, used instead of OnRun() when kernel supports it
+	void OnRunUring();
+
+	// submit send of queued messages, at most one send of a client is in flight,
+	// return -1 when client should be disconnected
+	int SendDataUring(CellClientTable::Slot& slot);
+
+	// completion based I/O, nullptr when reactor engine is used
+	std::unique_ptr<CellUring> _uring;
+
+	// clients whose send is in flight, kept alive until kernel no longer uses their buffer
+	CellClientTable _uringSends;
+
+	// clients removed while their recv is still in flight, socket is kept open until its last completion
+	// has arrived, otherwise a new connection may get the same fd and be handed data of the old one
+	CellClientTable _uringClosing;
+
+	// eventfd read by ring to wake up event loop
+	int _wakefd;
+
+	// value read from eventfd
+	uint64_t _wakeValue;
+#endif
+
 	// server socket
 	SOCKET _sock;
 
+	// listening socket this child server accepts on, INVALID_SOCKET when main thread accepts
+	SOCKET _listenSock;
+
 	// all client sockets connected with server, 
 	// we allocate its memory on heap to avoid stack overflow
-	// since each size of object is large
-	std::map<SOCKET, ClientPtr> _clients;
+	// since each size of object is large,
+	// indexed by socket so ready events find their client without searching
+	CellClientTable _clients;
 
-	// buffer queue to store clients sent from main thread
-	std::vector<ClientPtr> _clients_Buffer;
-
-	// mutex for accessing buffer queue
-	std::mutex _mutex;
+	// clients handed over by other threads, taken by event loop after it is woken up
+	CellMpscQueue<ClientPtr> _handoff;
 
 	// thread of child server
 	std::thread _thread;
 
-	// backup previous file descriptor set to improve performance
-	fd_set _fdRead_pre;
+	// readiness notification of client sockets (epoll on linux, select otherwise)
+	CellPollerPtr _poller;
+
+	// ready sockets reported by the poller in one iteration
+	std::vector<CellPollEvent> _events;
+
+	// data received from any client of this thread, so that clients only need buffers for incomplete messages,
+	// allocated by thread of this server after it is pinned, so it is in memory local to its cpu
+	std::unique_ptr<char[]> _szRecv;
 
-	// check if any clients connect or exit
-	bool _clients_change;
+	// a message wrapping around the end of a client ring buffer, or not starting at MESSAGE_ALIGN, is copied here
+	// before it is processed, shared by all clients of this thread since messages are processed one at a time
+	std::unique_ptr<char[]> _szStitch;
 
-	// used in linux environment
-	SOCKET _maxSock;
+	// cpu thread of this server is pinned to, -1 when not pinned
+	int _cpu;
+
+	// clients which have messages to send, posted by other threads
+	std::vector<SOCKET> _sendQueue;
+
+	// clients taken from send queue in one iteration
+	std::vector<SOCKET> _sendSocks;
+
+	// messages to all clients posted by other threads, and the ones taken in one iteration
+	std::vector<MsgBuf> _broadcastQueue;
+	std::vector<MsgBuf> _broadcastMsgs;
+
+	// mutex for accessing send queue and broadcast queue
+	std::mutex _sendMutex;
+
+	// limits of unsent data of each client
+	CellSendConfig _sendConfig;
+
+	// clients whose unsent data is above high watermark
+	std::vector<SOCKET> _blockedSocks;
+
+	// load read by other threads, only written by thread of this server
+	std::atomic<int> _clientCount;
+	std::atomic<long long> _recvBytes;
+	std::atomic<long long> _recvMsgs;
+
+	// taken and reset by main thread, so they are not single writer counters
+	std::atomic<int> _acceptCount;
+	std::atomic<int> _acceptWakeups;
+
+	// pending migration request, taken by thread of this server
+	std::mutex _migrateMutex;
+	ChildServer* _migrateTarget;
+	double _migrateMsgs;
+	std::atomic<bool> _migratePending;
+
+	// message rates of clients are being measured for pending request, since _migrateTime
+	bool _migrateMeasuring;
+	CELLTimestamp _migrateTime;
+
+	// worker threads running handlers, nullptr when handlers run on this thread
+	CellExecutor* _pExecutor;
 
 	// pointer points to main server, which can be used to call onExit() 
 	// to delete the number of connected clients
 	INetEvent* _pNetEvent;
-
-	// subServer for responding messages
-	CellTaskServer _taskServer;
 };
 
 using ChildServerPtr = std::shared_ptr<ChildServer>;
@@ -1,62 +1,187 @@
 #include "Client.hpp"
+#include "ChildServer.hpp"
+#include "CELLExecutor.hpp"
+#include "MemoryMgr.hpp"
 
-Client::Client(SOCKET sockfd = INVALID_SOCKET) :_sockfd{ sockfd }, _szMsgBuf{ {} }, _offset{ 0 }, _lastSendPos{ 0 } {
-	memset(_szMsgBuf, 0, RECV_BUFF_SIZE);
-	memset(_szSendBuf, 0, SEND_BUFF_SIZE);
-}
+#include <atomic>
+
+// ids of connections, starting from 1
+static std::atomic<unsigned long long> gNextId{ 1 };
+
+Client::Client(SOCKET sockfd = INVALID_SOCKET) :_sockfd{ sockfd }, _id{ gNextId++ }, _recvBuf{ RECV_BUFF_SIZE }, _sendBuf{}, _sendMutex{}, _pOwner{ nullptr },
+												_sendOverflow{ false }, _dropSend{ false }, _blockedTime{}, _strand{} {}
 
 SOCKET Client::getSockfd() {
 	return _sockfd;
 }
 
-char* Client::getMsgBuf() {
-	return _szMsgBuf;
+// id of connection, unlike socket numbers ids are never reused
+unsigned long long Client::getId() {
+	return _id;
 }
 
-int Client::getOffset() {
-	return _offset;
+// received data which has not formed a complete message yet
+CellRingBuffer& Client::getRecvBuf() {
+	return _recvBuf;
 }
 
-void Client::setOffset(int pos) {
-	_offset = pos;
+// queue message to be sent by the child server owning this client, can be called from any thread,
+// return SOCKET_ERROR when message is dropped by send budget
+int Client::sendMessage(const MsgBuf& msg) {
+	ChildServer* pOwner = nullptr;
+	bool dropped = false;
+
+	{
+		std::lock_guard<std::mutex> lock(_sendMutex);
+		dropped = !appendSend(msg, pOwner);
+	}
+
+	if (pOwner) pOwner->postSend(_sockfd);
+
+	return dropped ? SOCKET_ERROR : msg->length;
 }
 
-// send messages to clients
-int Client::sendMessage(DataHeaderPtr& header) {
-	int ret = SOCKET_ERROR;
+// queue message on thread of owner, which sends queued data itself afterwards,
+// return SOCKET_ERROR when message is dropped by send budget
+int Client::queueMessage(const MsgBuf& msg) {
+	ChildServer* pOwner = nullptr;
 
-	int nSendLen = header->length;
-	const char* pSendData = (const char*)header.get();
+	std::lock_guard<std::mutex> lock(_sendMutex);
+	return appendSend(msg, pOwner) ? msg->length : SOCKET_ERROR;
+}
 
-	while (true) {
-		// reach buffer size limit
-		if (_lastSendPos + nSendLen >= SEND_BUFF_SIZE) {
-			// count number of messages we can send
-			int nCopyLen = SEND_BUFF_SIZE - _lastSendPos;
+// append message to send buffer, called with send lock held, pOwner is set when owner needs to be told,
+// return false when message is dropped by send budget
+bool Client::appendSend(const MsgBuf& msg, ChildServer*& pOwner) {
+	// limits used before client joins a child server
+	static const CellSendConfig defaultConfig;
 
-			// only copy certain amount of next message to fill the buffer
-			memcpy(_szSendBuf + _lastSendPos, pSendData, nCopyLen);
+	const CellSendConfig& config = _pOwner ? _pOwner->getSendConfig() : defaultConfig;
+	size_t nSize = _sendBuf.size();
 
-			// increase pointer 
-			pSendData += nCopyLen;
+	// client cannot keep up with messages sent to it, only whole messages are dropped
+	if (_dropSend || nSize + msg->length > config.maxBytes || !_sendBuf.write((const char*)msg.get(), msg->length)) {
+		// owner applies slow client policy once
+		if (!_sendOverflow) pOwner = _pOwner;
+		_sendOverflow = true;
+		return false;
+	}
 
-			// decrease len of next message to be copied into buffer
-			nSendLen -= nCopyLen;
+	if (nSize == 0 || (nSize < config.highWatermark && _sendBuf.size() >= config.highWatermark)) {
+		// owner only needs to be told when queue becomes non-empty or reaches high watermark,
+		// later messages are sent together
+		pOwner = _pOwner;
+	}
 
-			// send messages when receive large enough messages
-			ret = send(_sockfd, _szSendBuf, SEND_BUFF_SIZE, 0);
+	return true;
+}
 
-			// reset offset
-			_lastSendPos = 0;
+// child server which sends queued messages, set when client joins it
+void Client::setOwner(ChildServer* pOwner) {
+	std::lock_guard<std::mutex> lock(_sendMutex);
+	_pOwner = pOwner;
+}
 
-			if (ret == SOCKET_ERROR) return ret;
-		}
-		else {
-			memcpy(_szSendBuf + _lastSendPos, pSendData, nSendLen);
-			_lastSendPos += nSendLen;
-			break;
-		}
+// send queued data without blocking until socket cannot take more,
+// return number of bytes still queued or SOCKET_ERROR when connection is broken
+int Client::flushSend() {
+	std::lock_guard<std::mutex> lock(_sendMutex);
+
+	while (_sendBuf.size() > 0) {
+		if (_sendBuf.sendTo(_sockfd) >= 0) continue;
+
+		if (isInterrupted()) continue;
+
+		// kernel buffer is full, rest is sent when socket becomes writable
+		if (isWouldBlock()) break;
+
+		return SOCKET_ERROR;
 	}
 
-	return ret;
+	return (int)_sendBuf.size();
+}
+
+// contiguous queued data which can be handed to kernel by io_uring,
+// it stays in place until sendDone() is called
+const char* Client::getSendData(int& nLen) {
+	std::lock_guard<std::mutex> lock(_sendMutex);
+
+	// appending messages from other threads never moves queued blocks
+	size_t nSize = 0;
+	const char* pData = _sendBuf.front(nSize);
+
+	nLen = (int)nSize;
+	return pData;
+}
+
+// remove data sent by io_uring from queue, return number of bytes still queued
+int Client::sendDone(int nLen) {
+	std::lock_guard<std::mutex> lock(_sendMutex);
+
+	_sendBuf.consume(nLen);
+	return (int)_sendBuf.size();
+}
+
+// number of bytes queued
+int Client::getSendSize() {
+	std::lock_guard<std::mutex> lock(_sendMutex);
+	return (int)_sendBuf.size();
+}
+
+// check if a message has been dropped by byte budget since last call
+bool Client::takeSendOverflow() {
+	std::lock_guard<std::mutex> lock(_sendMutex);
+
+	bool overflow = _sendOverflow;
+	_sendOverflow = false;
+	return overflow;
+}
+
+// drop all new messages until queue drains, used when client exceeds time budget
+void Client::setDropSend(bool drop) {
+	std::lock_guard<std::mutex> lock(_sendMutex);
+	_dropSend = drop;
+}
+
+bool Client::isDropSend() {
+	return _dropSend;
+}
+
+// unsent data has just reached high watermark, the blocked state itself is kept by owner in its client table
+void Client::updateBlockedTime() {
+	_blockedTime.update();
+}
+
+// millisecond since unsent data reached high watermark
+double Client::getBlockedTime() {
+	return _blockedTime.getElapsedTimeInMilliSec();
+}
+
+// runs handlers of this client on worker threads in message order, created on first use by owner thread
+std::shared_ptr<CellStrand>& Client::getStrand(CellExecutor* pExecutor) {
+	if (!_strand) {
+		// owner resumes reading when it is woken up to send
+		_strand = std::allocate_shared<CellStrand>(MemoryAllocator<CellStrand>(), pExecutor, [this]() {
+			std::lock_guard<std::mutex> lock(_sendMutex);
+			if (_pOwner) _pOwner->postSend(_sockfd);
+		});
+	}
+
+	return _strand;
+}
+
+// handlers on worker threads fall behind and reading should stop
+bool Client::isStrandThrottled() {
+	return _strand && _strand->isThrottled();
+}
+
+Client::~Client() {
+	if (_sockfd == INVALID_SOCKET) return;
+
+#		ifdef _WIN32
+	closesocket(_sockfd);
+#		else
+	close(_sockfd);
+#		endif
+	_sockfd = INVALID_SOCKET;
 }
@@ -4,8 +4,40 @@
 #include "Cell.hpp"
 #include "ObjectPool.hpp"
 #include "Message.hpp"
+#include "CELLBuffer.hpp"
+#include "CELLTimestamp.hpp"
 
 #include <memory>
+#include <mutex>
+
+class ChildServer;
+class CellStrand;
+class CellExecutor;
+
+// what child server does with a client which does not read messages sent to it fast enough
+enum class CellSlowClientPolicy {
+	// drop messages exceeding byte budget, and all new messages after time budget until queue drains to low watermark
+	Drop,
+	// close connection when either budget is exceeded
+	Disconnect,
+	// stop reading requests while unsent data is above high watermark, close connection after time budget
+	PauseReads
+};
+
+// limits of unsent data of each client
+struct CellSendConfig {
+	// OnWriteBlocked is called when unsent data reaches high watermark, OnWriteDrained when it falls back to low watermark
+	size_t lowWatermark = SEND_BUFF_SIZE / 4;
+	size_t highWatermark = SEND_BUFF_SIZE;
+
+	// byte budget, unsent data never grows beyond it
+	size_t maxBytes = SEND_BUFF_SIZE * 20;
+
+	// time budget, how long unsent data may stay above high watermark (in millisecond)
+	int maxBlockedMs = 10000;
+
+	CellSlowClientPolicy policy = CellSlowClientPolicy::Drop;
+};
 
 // client socket info, we can accept up to 10_000 clients at the same time
 class Client : public ObjectPoolBase<Client, 10000> {
@@ -14,30 +46,95 @@ public:
 
 	SOCKET getSockfd();
 
-	char* getMsgBuf();
+	// id of connection, unlike socket numbers ids are never reused
+	unsigned long long getId();
+
+	// received data which has not formed a complete message yet
+	CellRingBuffer& getRecvBuf();
+
+	// queue message to be sent by the child server owning this client, can be called from any thread,
+	// return SOCKET_ERROR when message is dropped by send budget
+	int sendMessage(const MsgBuf& msg);
+
+	// queue message on thread of owner, which sends queued data itself afterwards,
+	// return SOCKET_ERROR when message is dropped by send budget
+	int queueMessage(const MsgBuf& msg);
+
+	// child server which sends queued messages, set when client joins it
+	void setOwner(ChildServer* pOwner);
+
+	// send queued data without blocking until socket cannot take more,
+	// return number of bytes still queued or SOCKET_ERROR when connection is broken
+	int flushSend();
+
+	// contiguous queued data which can be handed to kernel by io_uring,
+	// it stays in place until sendDone() is called
+	const char* getSendData(int& nLen);
 
-	int getOffset();
+	// remove data sent by io_uring from queue, return number of bytes still queued
+	int sendDone(int nLen);
 
-	void setOffset(int pos);
+	// number of bytes queued
+	int getSendSize();
 
-	// send messages to clients
-	int sendMessage(DataHeaderPtr& header);
+	// check if a message has been dropped by byte budget since last call
+	bool takeSendOverflow();
+
+	// following states are only changed by owner thread
+
+	// drop all new messages until queue drains, used when client exceeds time budget
+	void setDropSend(bool drop);
+
+	bool isDropSend();
+
+	// unsent data has just reached high watermark, the blocked state itself is kept by owner in its client table
+	void updateBlockedTime();
+
+	// millisecond since unsent data reached high watermark
+	double getBlockedTime();
+
+	// runs handlers of this client on worker threads in message order, created on first use by owner thread
+	std::shared_ptr<CellStrand>& getStrand(CellExecutor* pExecutor);
+
+	// handlers on worker threads fall behind and reading should stop
+	bool isStrandThrottled();
+
+	// close socket when client is no longer referenced by any server
+	~Client();
 
 private:
+	// append message to send buffer, called with send lock held, pOwner is set when owner needs to be told,
+	// return false when message is dropped by send budget
+	bool appendSend(const MsgBuf& msg, ChildServer*& pOwner);
+
 	// socket fd, which will be put into selcet function
 	SOCKET _sockfd;
 
-	// buffer which stores data after we receive it from the buffer inside OS kernel
-	char _szMsgBuf[RECV_BUFF_SIZE];
+	unsigned long long _id;
+
+	// incomplete message left after data received from the buffer inside OS kernel has been processed,
+	// memory is only taken from buffer pool while there is such data
+	CellRingBuffer _recvBuf;
+
+	// messages which would be sent to clients later, chained blocks are only taken from buffer pool
+	// while there are messages not sent
+	CellBufferChain _sendBuf;
+
+	// send buffer is filled by any thread and drained by owner thread
+	std::mutex _sendMutex;
+
+	ChildServer* _pOwner;
+
+	// a message has been dropped by byte budget
+	bool _sendOverflow;
 
-	// offset pointer pointing to the end of messages received from _szRecv
-	int _offset;
+	// all new messages are dropped
+	bool _dropSend;
 
-	// buffer which stores messages which would be sent to clients later
-	char _szSendBuf[SEND_BUFF_SIZE];
+	// time when unsent data reached high watermark
+	CELLTimestamp _blockedTime;
 
-	// offset pointers pointing to the end end of messages received from _szSendBuf
-	int _lastSendPos;
+	std::shared_ptr<CellStrand> _strand;
 };
 
 using ClientPtr = std::shared_ptr<Client>;
@@ -14,8 +14,19 @@ public:
 	// client exits server
 	virtual void OnJoin(ClientPtr& clientSock) = 0;
 	virtual void OnExit(ClientPtr& clientSock) = 0;
-	virtual void OnNetMsg(ChildServer* pChildServer, ClientPtr& clientSock, DataHeaderPtr header) = 0;
+	// msg points into receive buffer of client and is only valid during the call
+	virtual void OnNetMsg(ChildServer* pChildServer, ClientPtr& clientSock, const MessageView& msg) = 0;
+	// when handlers run on worker threads, return true to handle a cheap message on I/O thread instead,
+	// it is only done when no earlier message of client is still waiting for a worker
+	virtual bool isInlineMsg(ChildServer* pChildServer, ClientPtr& clientSock, const MessageView& msg) = 0;
 	virtual void OnNetRecv(ClientPtr& clientSock) = 0;
+	// unsent data of client reaches high watermark, handler should stop producing messages for it,
+	// called by thread of child server
+	virtual void OnWriteBlocked(ChildServer* pChildServer, ClientPtr& clientSock) = 0;
+	// unsent data falls back to low watermark, or blocked client exits before it does
+	virtual void OnWriteDrained(ChildServer* pChildServer, ClientPtr& clientSock) = 0;
+	// client is moved to a less loaded child server, called by thread of the server it leaves
+	virtual void OnMigrate(ChildServer* pFrom, ChildServer* pTo, ClientPtr& clientSock) = 0;
 	~INetEvent() = default;
 
 private:
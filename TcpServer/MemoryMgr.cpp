@@ -1,47 +1,182 @@
 #include "MemoryMgr.hpp"
 
+#ifdef _WIN32
+#	ifndef WIN32_LEAN_AND_MEAN
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#include <windows.h>
+#else
+#	include <sys/mman.h>
+#	include <unistd.h>
+#endif
+
 MemoryBlock::MemoryBlock() : pNext{ nullptr } {};
 
 MemoryBlock::~MemoryBlock() {};
 
+// if the block is in pool, blocks taken from heap have no sequence number
+bool MemoryBlock::inPool() const {
+	return nID >= 0;
+}
+
+// drop one reference, return true when it was the last one and block can be freed
+bool MemoryBlock::release() {
+	// a single user cannot race with anyone adding a reference, so it needs no locked instruction
+	if (nRef.load(std::memory_order_acquire) == 1) {
+		nRef.store(0, std::memory_order_relaxed);
+		return true;
+	}
+
+	return nRef.fetch_sub(1, std::memory_order_acq_rel) == 1;
+}
+
+// state of cache of current thread
+enum class CacheState : char {
+	// thread has not requested memory yet
+	Unused,
+	// blocks are cached
+	Active,
+	// thread is exiting or caches are switched off, memory goes to pools directly
+	Released
+};
+
+// caches of current thread, one free list for each size class. they are plain data,
+// so they can still be used by destructors running after releaseCache
+static thread_local MemoryFreeList tCaches[MemoryClasses::count()];
+static thread_local CacheState tCacheState = CacheState::Unused;
+
+// counters of one thread, only written by their thread and read by snapshots.
+// last index counts requests larger than MAX_MEMORY_SIZE
+struct MemoryThreadStats {
+	std::atomic<long long> nAlloc[MemoryClasses::count() + 1];
+	std::atomic<long long> nHeap[MemoryClasses::count() + 1];
+	std::atomic<long long> nFree[MemoryClasses::count() + 1];
+
+	MemoryThreadStats* pPrev;
+	MemoryThreadStats* pNext;
+};
+
+static thread_local MemoryThreadStats tStats;
+
+// counters of running threads, and the sum of threads which have exited
+static std::mutex gStatsMutex;
+static MemoryThreadStats* gStatsList = nullptr;
+static MemoryThreadStats gRetiredStats;
+
+// counter only has one writer, so it needs no locked instruction
+static inline void countUp(std::atomic<long long>& counter) {
+	counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// add counters of exiting thread to retired ones and stop listing them
+static void retireStats(MemoryThreadStats* pStats) {
+	std::lock_guard<std::mutex> lock(gStatsMutex);
+
+	for (int i = 0; i <= MemoryClasses::count(); i++) {
+		gRetiredStats.nAlloc[i] += pStats->nAlloc[i];
+		gRetiredStats.nHeap[i] += pStats->nHeap[i];
+		gRetiredStats.nFree[i] += pStats->nFree[i];
+		pStats->nAlloc[i] = 0;
+		pStats->nHeap[i] = 0;
+		pStats->nFree[i] = 0;
+	}
+
+	if (pStats->pPrev) pStats->pPrev->pNext = pStats->pNext;
+	else gStatsList = pStats->pNext;
+	if (pStats->pNext) pStats->pNext->pPrev = pStats->pPrev;
+}
+
+// gives cached blocks back when thread exits, so blocks are not lost with the thread
+class MemoryCacheGuard {
+public:
+	~MemoryCacheGuard() {
+		MemoryMgr::getInstance().releaseCache();
+
+		// requests made by destructors running after this are not counted
+		retireStats(&tStats);
+	}
+};
+
+static thread_local MemoryCacheGuard tCacheGuard;
+
+std::atomic<bool> MemoryPool::_bThreadCache{ true };
+
 // memory pool
-MemoryPool::MemoryPool() :_pBuf{ nullptr }, _pHeader{ nullptr }, _nSize{ 0 }, _nBlock{ 0 } {};
+MemoryPool::MemoryPool() :_pChunk{ nullptr }, _pFree{ nullptr }, _pEnd{ nullptr }, _pHeader{ nullptr }, _nFreeBlock{ 0 }, _nChunkSize{ 0 }, _nSize{ 0 }, _nBlock{ 0 }, _nMaxBlock{ 0 }, _nIndex{ 0 }, _nBatch{ 1 } {};
+
+// nMaxSize: limit of memory pool grows to in bytes
+// nIndex: size class of pool, selects free list of thread caches
+MemoryPool::MemoryPool(size_t nSize, size_t nMaxSize, int nIndex) :_pChunk{ nullptr }, _pFree{ nullptr }, _pEnd{ nullptr }, _pHeader{ nullptr }, _nFreeBlock{ 0 }, _nChunkSize{ 0 }, _nSize{ 0 }, _nBlock{ 0 }, _nMaxBlock{ 0 }, _nIndex{ 0 }, _nBatch{ 1 } {
+	init(nSize, nMaxSize, nIndex);
+};
+
+MemoryPool::~MemoryPool() {
+	while (_pChunk) {
+		MemoryChunk* pChunk = _pChunk;
+		_pChunk = pChunk->pNext;
+#ifdef _WIN32
+		VirtualFree(pChunk, 0, MEM_RELEASE);
+#else
+		munmap(pChunk, pChunk->nSize);
+#endif
+	}
+};
+
+// set up an empty pool, nMaxSize: limit of memory pool grows to in bytes
+// nIndex: size class of pool, selects free list of thread caches
+void MemoryPool::init(size_t nSize, size_t nMaxSize, int nIndex) {
+	assert(_pChunk == nullptr);
+	_nIndex = nIndex;
 
-MemoryPool::MemoryPool(size_t nSize, size_t nBlock) :_pBuf{ nullptr }, _pHeader{ nullptr }, _nSize{ nSize }, _nBlock{ nBlock } {
 	// get the size of pointer for memory alignment
 	const size_t n = sizeof(void*);
 
 	// resize memory block
 	_nSize = (nSize / n) * n + (nSize % n ? n : 0);
-};
+	_nMaxBlock = nMaxSize / (_nSize + sizeof(MemoryBlock));
 
-MemoryPool::~MemoryPool() {
-	if (_pBuf) free(_pBuf);
-};
+	// about 8KB are moved at a time
+	_nBatch = (int)(8192 / _nSize);
+	if (_nBatch > MEMORY_CACHE_BATCH) _nBatch = MEMORY_CACHE_BATCH;
+	if (_nBatch < 2) _nBatch = 2;
+}
 
 // request memroy and return it to manager
 void* MemoryPool::allocMem(size_t nSize) {
-	std::lock_guard<std::mutex> lock(_mutex);
+	MemoryFreeList* pList = getCache();
+	MemoryBlock* pRet{ nullptr };
 
-	if (!_pBuf) initMemory();
+	if (pList) {
+		// refill empty cache with a batch of blocks
+		if (pList->pHeader == nullptr) {
+			pList->nCount = allocBatch(pList->pHeader, pList->pTail, _nBatch);
+		}
 
-	MemoryBlock* pRet{ nullptr };
+		if (pList->pHeader) {
+			pRet = pList->pHeader;
+			pList->pHeader = pRet->pNext;
+			if (--pList->nCount == 0) pList->pTail = nullptr;
+		}
+	}
+	else {
+		MemoryBlock* pTail{ nullptr };
+		allocBatch(pRet, pTail, 1);
+	}
 
-	if (_pHeader == nullptr) {
-		pRet = (MemoryBlock*)malloc(nSize + sizeof(MemoryBlock));
-		pRet->bPool = false;
-		pRet->nID = -1;
-		pRet->nRef = 1;
-		pRet->pPool = nullptr;
-		pRet->pNext = nullptr;
+	if (pRet == nullptr) {
+		pRet = allocHeap(nSize);
+		countUp(tStats.nHeap[_nIndex]);
 	}
 	else {
-		pRet = _pHeader;
-		_pHeader = _pHeader->pNext;
 		assert(pRet->nRef == 0);
-		pRet->nRef = 1;
+		pRet->nRef.store(1, std::memory_order_relaxed);
+
+		// block leaves free list, its link becomes the pool it is freed to
+		pRet->pPool = this;
 	}
 
+	countUp(tStats.nAlloc[_nIndex]);
+
 	xPrintf("allocMem: %llx, id=%d, size=%d \n", pRet, pRet->nID, nSize);
 	// reset pointer to skip 
 	return ((char*)pRet + sizeof(MemoryBlock));
@@ -53,61 +188,224 @@ void MemoryPool::freeMem(void* pMem) {
 	// pointer to the header of memory block
 	MemoryBlock* pBlock = (MemoryBlock*)((char*)pMem - sizeof(MemoryBlock));
 
-	//assert(pBlock->nRef == 1);
-
-	std::lock_guard<std::mutex> lock(_mutex);
-	if (pBlock->nRef-- > 1) {
-		// memory block is accessed by more than 1 server
+	if (!pBlock->release()) {
+		// memory block is still shared with other users
 		return;
 	}
 
-	if (pBlock->bPool) {
-		// set the current block as the first block to be used next time, manage memory pool as linklist
-		pBlock->pNext = _pHeader;
-		_pHeader = pBlock;
-	}
-	else {
+	MemoryFreeList* pList = getCache();
+	countUp(tStats.nFree[_nIndex]);
+
+	if (!pBlock->inPool()) {
 		// an extra memory not existing in memory pool
 		free(pBlock);
+		return;
 	}
+
+	if (pList == nullptr) {
+		pBlock->pNext = nullptr;
+		freeBatch(pBlock, pBlock, 1);
+		return;
+	}
+
+	// blocks freed by another thread than the one which requested them are cached here as well,
+	// they go back to pool once this thread holds too many of them
+	pBlock->pNext = pList->pHeader;
+	pList->pHeader = pBlock;
+	if (pList->pTail == nullptr) pList->pTail = pBlock;
+
+	if (++pList->nCount < 2 * _nBatch) return;
+
+	// keep the blocks freed last, they are most likely still in cpu cache
+	MemoryBlock* pKeep = pList->pHeader;
+	for (int i = 1; i < _nBatch; i++) {
+		pKeep = pKeep->pNext;
+	}
+
+	freeBatch(pKeep->pNext, pList->pTail, pList->nCount - _nBatch);
+	pKeep->pNext = nullptr;
+	pList->pTail = pKeep;
+	pList->nCount = _nBatch;
 }
 
-void MemoryPool::initMemory() {
-	assert(_pBuf == nullptr);
+// give blocks cached by current thread back to pool
+void MemoryPool::releaseCache() {
+	if (tCacheState != CacheState::Active) return;
 
-	if (_pBuf) {
-		std::cout << "Memory pool has been initialized" << std::endl;
-		return;
+	MemoryFreeList& list = tCaches[_nIndex];
+
+	if (list.pHeader) freeBatch(list.pHeader, list.pTail, list.nCount);
+
+	list.pHeader = nullptr;
+	list.pTail = nullptr;
+	list.nCount = 0;
+}
+
+// switch thread caches on or off, only threads which have not requested memory yet are affected
+void MemoryPool::setThreadCache(bool bEnable) {
+	_bThreadCache = bEnable;
+}
+
+// free list of current thread, nullptr when thread does not cache blocks
+MemoryFreeList* MemoryPool::getCache() {
+	if (tCacheState == CacheState::Active) return &tCaches[_nIndex];
+
+	if (tCacheState == CacheState::Unused) {
+		initThread();
+		if (tCacheState == CacheState::Active) return &tCaches[_nIndex];
 	}
 
-	// total size of pool
-	size_t each_buf = _nSize + sizeof(MemoryBlock);
-	size_t bufSize = each_buf * _nBlock;
+	return nullptr;
+}
+
+// set up caches and counters of current thread, called on its first request
+void MemoryPool::initThread() {
+	if (tCacheState != CacheState::Unused) return;
+
+	// first use of guard registers its destructor for this thread
+	(void)&tCacheGuard;
+
+	{
+		std::lock_guard<std::mutex> lock(gStatsMutex);
+		tStats.pPrev = nullptr;
+		tStats.pNext = gStatsList;
+		if (gStatsList) gStatsList->pPrev = &tStats;
+		gStatsList = &tStats;
+	}
+
+	tCacheState = _bThreadCache ? CacheState::Active : CacheState::Released;
+}
+
+// take up to nCount blocks from pool with one lock, return number of blocks taken
+int MemoryPool::allocBatch(MemoryBlock*& pHead, MemoryBlock*& pTail, int nCount) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	pHead = _pHeader;
+	pTail = nullptr;
+
+	int n = 0;
+	for (MemoryBlock* pBlock = _pHeader; pBlock && n < nCount; pBlock = pBlock->pNext) {
+		pTail = pBlock;
+		n++;
+	}
 
-	// request memory to initialize pool
-	_pBuf = (char*)malloc(bufSize);
+	if (pTail) {
+		_pHeader = pTail->pNext;
+		pTail->pNext = nullptr;
+	}
+
+	_nFreeBlock -= n;
 
-	_pHeader = (MemoryBlock*)_pBuf;
-	_pHeader->bPool = true;
-	_pHeader->nID = 0;
-	_pHeader->nRef = 0;
-	_pHeader->pPool = this;
-	_pHeader->pNext = nullptr;
+	// no block has been freed, take new ones from chunks
+	while (n < nCount) {
+		MemoryBlock* pBlock = newBlock();
+		if (pBlock == nullptr) break;
 
-	MemoryBlock* pTemp1 = _pHeader;
-	// initialize pool (each block)
-	for (size_t i = 1; i < _nBlock; i++) {
-		MemoryBlock* pTemp2 = (MemoryBlock*)(_pBuf + (i * each_buf));
+		if (pTail) pTail->pNext = pBlock;
+		else pHead = pBlock;
 
-		pTemp2->bPool = true;
-		pTemp2->nID = i;
-		pTemp2->nRef = 0;
-		pTemp2->pPool = this;
-		pTemp2->pNext = nullptr;
-		// let the pointer of last block points to current block
-		pTemp1->pNext = pTemp2;
-		pTemp1 = pTemp2;
+		pTail = pBlock;
+		n++;
 	}
+
+	return n;
+}
+
+// put list of nCount blocks back into pool with one lock
+void MemoryPool::freeBatch(MemoryBlock* pHead, MemoryBlock* pTail, int nCount) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_nFreeBlock += nCount;
+
+	// set the returned blocks as the first blocks to be used next time, manage memory pool as linklist
+	pTail->pNext = _pHeader;
+	_pHeader = pHead;
+}
+
+// memory requested from heap when pool is used up
+MemoryBlock* MemoryPool::allocHeap(size_t nSize) {
+	MemoryBlock* pRet = (MemoryBlock*)malloc(nSize + sizeof(MemoryBlock));
+	pRet->nID = -1;
+	pRet->nRef.store(1, std::memory_order_relaxed);
+	// block is freed through its pool, so it is counted in its size class
+	pRet->pPool = this;
+	return pRet;
+}
+
+// limit memory pool grows to, chunks already added are kept
+void MemoryPool::setMaxSize(size_t nMaxSize) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_nMaxBlock = nMaxSize / (_nSize + sizeof(MemoryBlock));
+}
+
+// take a new block from newest chunk, nullptr when pool has reached its limit
+MemoryBlock* MemoryPool::newBlock() {
+	size_t each_buf = _nSize + sizeof(MemoryBlock);
+
+	if (_nBlock >= _nMaxBlock) return nullptr;
+
+	// blocks are only linked and touched when they are handed out, so a pool costs no memory before it is used
+	if ((size_t)(_pEnd - _pFree) < each_buf && !addChunk()) return nullptr;
+
+	MemoryBlock* pBlock = (MemoryBlock*)_pFree;
+	_pFree += each_buf;
+
+	pBlock->nID = (int)_nBlock++;
+	pBlock->nRef.store(0, std::memory_order_relaxed);
+	pBlock->pNext = nullptr;
+	return pBlock;
+}
+
+// grow pool by one chunk, return false when system has no memory left
+bool MemoryPool::addChunk() {
+	size_t each_buf = _nSize + sizeof(MemoryBlock);
+	size_t nPage = getPageSize();
+
+	// a chunk holds at least one block
+	size_t nSize = MEMORY_CHUNK_SIZE;
+	if (nSize < sizeof(MemoryChunk) + each_buf) nSize = sizeof(MemoryChunk) + each_buf;
+	nSize = (nSize + nPage - 1) / nPage * nPage;
+
+	// pages are requested from system directly, they are aligned and only backed by memory once touched
+#ifdef _WIN32
+	void* pMem = VirtualAlloc(nullptr, nSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (pMem == nullptr) return false;
+#else
+	void* pMem = mmap(nullptr, nSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pMem == MAP_FAILED) return false;
+#endif
+
+	MemoryChunk* pChunk = (MemoryChunk*)pMem;
+	pChunk->pNext = _pChunk;
+	pChunk->nSize = nSize;
+	_pChunk = pChunk;
+	_nChunkSize += nSize;
+
+	// rest of previous chunk is too small for a block and stays unused
+	_pFree = (char*)pMem + sizeof(MemoryChunk);
+	_pEnd = (char*)pMem + nSize;
+	return true;
+}
+
+// fill in size, chunks and free list of pool, counters of threads are added by manager
+void MemoryPool::getStats(MemoryPoolStats& stats) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	stats.nSize = _nSize;
+	stats.nBlock = _nBlock;
+	stats.nMaxBlock = _nMaxBlock;
+	stats.nFreeBlock = _nFreeBlock;
+	stats.nChunkSize = _nChunkSize;
+}
+
+size_t MemoryPool::getPageSize() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
 }
 
 // memory manager
@@ -119,16 +417,18 @@ MemoryMgr& MemoryMgr::getInstance() {
 void* MemoryMgr::allocMem(size_t nSize) {
 	if (nSize <= MAX_MEMORY_SIZE) {
 		// the requested memroy can be fit into memory pool
-		return _szAlloc[nSize]->allocMem(nSize);
+		return _pools[MemoryClasses::index(nSize)].allocMem(nSize);
 	}
 	else {
+		MemoryPool::initThread();
+		countUp(tStats.nAlloc[MemoryClasses::count()]);
+		countUp(tStats.nHeap[MemoryClasses::count()]);
+
 		// request memory in heap
 		MemoryBlock* pRet = (MemoryBlock*)malloc(nSize + sizeof(MemoryBlock));
-		pRet->bPool = false;
 		pRet->nID = -1;
-		pRet->nRef = 1;
+		pRet->nRef.store(1, std::memory_order_relaxed);
 		pRet->pPool = nullptr;
-		pRet->pNext = nullptr;
 		xPrintf("allocMem: %llx, id=%d, size=%d \n", pRet, pRet->nID, nSize);
 		return ((char*)pRet + sizeof(MemoryBlock));
 	}
@@ -138,12 +438,15 @@ void* MemoryMgr::allocMem(size_t nSize) {
 void MemoryMgr::freeMem(void* pMem) {
 	MemoryBlock* pBlock = (MemoryBlock*)((char*)pMem - sizeof(MemoryBlock));
 	xPrintf("freeMem: %llx, id=%d \n", pBlock, pBlock->nID);
-	if (pBlock->bPool) {
-		// memroy in memory pool
+	if (pBlock->pPool) {
+		// memroy in memory pool, or taken from heap when pool was at its limit
 		pBlock->pPool->freeMem(pMem);
 	}
 	else {
-		if (--pBlock->nRef == 0) {
+		if (pBlock->release()) {
+			MemoryPool::initThread();
+			countUp(tStats.nFree[MemoryClasses::count()]);
+
 			// memory in heap
 			free(pBlock);
 		}
@@ -153,31 +456,70 @@ void MemoryMgr::freeMem(void* pMem) {
 void MemoryMgr::addRef(void* pMem) {
 	// when a same memory is shared, increase ref count
 	MemoryBlock* pBlock = (MemoryBlock*)((char*)pMem - sizeof(MemoryBlock));
-	pBlock->nRef++;
+	pBlock->nRef.fetch_add(1, std::memory_order_relaxed);
+}
+
+// give blocks cached by current thread back to pools, called when a thread exits
+void MemoryMgr::releaseCache() {
+	for (auto& pool : _pools) {
+		pool.releaseCache();
+	}
+
+	// memory freed by destructors running after this goes to pools directly
+	tCacheState = CacheState::Released;
 }
 
+// switch thread caches on or off, only threads which have not requested memory yet are affected
+void MemoryMgr::setThreadCache(bool bEnable) {
+	MemoryPool::setThreadCache(bEnable);
+}
 
-// initialize mapping array
-void MemoryMgr::init(int nBegin, int nEnd, MemoryPool* pMemP) {
-	for (int i = nBegin; i <= nEnd; i++) {
-		_szAlloc[i] = pMemP;
+// limit memory each pool grows to in bytes
+void MemoryMgr::setMaxPoolSize(size_t nMaxSize) {
+	for (auto& pool : _pools) {
+		pool.setMaxSize(nMaxSize);
 	}
 }
 
+// counters of all threads and state of pools, threads keep running while it is taken
+MemoryStats MemoryMgr::getStats() {
+	MemoryStats stats{};
+
+	for (int i = 0; i < MemoryClasses::count(); i++) {
+		_pools[i].getStats(stats.pools[i]);
+	}
+
+	std::lock_guard<std::mutex> lock(gStatsMutex);
+
+	auto addStats = [&stats](MemoryThreadStats& threadStats) {
+		for (int i = 0; i <= MemoryClasses::count(); i++) {
+			stats.pools[i].nAlloc += threadStats.nAlloc[i].load(std::memory_order_relaxed);
+			stats.pools[i].nHeap += threadStats.nHeap[i].load(std::memory_order_relaxed);
+			stats.pools[i].nFree += threadStats.nFree[i].load(std::memory_order_relaxed);
+		}
+	};
+
+	addStats(gRetiredStats);
+
+	for (MemoryThreadStats* pStats = gStatsList; pStats; pStats = pStats->pNext) {
+		addStats(*pStats);
+		stats.nThreads++;
+	}
+
+	for (auto& pool : stats.pools) {
+		pool.nLive = pool.nAlloc - pool.nFree;
+	}
+
+	return stats;
+}
+
+
 // stop user trying to initialize manager
-MemoryMgr::MemoryMgr() : _pool64{ 64, 100000 },
-	_pool128{ 128, 100000 },
-	_pool256{ 256, 100000 },
-	_pool512{ 512, 100000 },
-	_pool1024{ 1024, 100000 } {
-
-	// when adjust max pool size, needs to redefine MAX_MEMORY_SIZE
-	init(0, 64, &_pool64);
-	init(65, 128, &_pool128);
-	init(0, 128, &_pool128);
-	init(129, 256, &_pool256);
-	init(257, 512, &_pool512);
-	init(512, 1024, &_pool1024);
+MemoryMgr::MemoryMgr() {
+	// size of a request is mapped to its pool by computing its class, so pools are set up from the same classes
+	for (int i = 0; i < MemoryClasses::count(); i++) {
+		_pools[i].init(MemoryClasses::size(i), MEMORY_POOL_MAX_SIZE, i);
+	}
 };
 
 MemoryMgr::~MemoryMgr() {};
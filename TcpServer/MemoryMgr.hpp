@@ -5,10 +5,22 @@
 #include <assert.h>
 #include <iostream>
 #include <mutex>
+#include <atomic>
+
+#include "MemorySizeClass.hpp"
 
 // maximum size of each memory block
 #define MAX_MEMORY_SIZE 1024
 
+// most blocks moved between a thread cache and its pool at a time, fewer for large blocks
+#define MEMORY_CACHE_BATCH 32
+
+// pools grow by chunks of this size, rounded up to whole pages
+#define MEMORY_CHUNK_SIZE (64 * 1024)
+
+// default limit of memory each pool grows to, requests beyond it go to heap
+#define MEMORY_POOL_MAX_SIZE (128 * 1024 * 1024)
+
 // DEBUG print
 #ifdef _DEBUG
 	#include <stdio.h>
@@ -17,32 +29,95 @@
 	#define xPrintf(...)
 #endif
 
+// one memory pool for each size class
+using MemoryClasses = MemorySizeClass<MEMORY_QUANTUM, MEMORY_CLASS_GROUP, MAX_MEMORY_SIZE>;
+
+static_assert(MemoryClasses::size(MemoryClasses::count() - 1) == MAX_MEMORY_SIZE, "largest size class must be MAX_MEMORY_SIZE");
+
 class MemoryPool;
 
-// header of each memory block
+// header of each memory block, 16 bytes so blocks stay aligned like malloc
 class MemoryBlock {
 public:
 	MemoryBlock();
 
 	~MemoryBlock();
 
-	// sequence number of block
+	// if the block is in pool, blocks taken from heap have no sequence number
+	bool inPool() const;
+
+	// drop one reference, return true when it was the last one and block can be freed
+	bool release();
+
+	union {
+		// the memory pool it belongs to while it is in use, nullptr for requests larger than any block
+		MemoryPool* pPool;
+
+		// pointer to next block while it is on a free list, its pool is known then
+		MemoryBlock* pNext;
+	};
+
+	// number of user accessing this block, blocks shared by MsgBuf are released by several threads
+	std::atomic<int> nRef;
+
+	// sequence number of block, -1 when it is taken from heap
 	int nID;
+};
+
+static_assert(sizeof(MemoryBlock) % MEMORY_QUANTUM == 0, "block header breaks alignment of blocks");
+
+// header of each chunk of memory a pool grows by
+struct MemoryChunk {
+	MemoryChunk* pNext;
+
+	// size of chunk including header
+	size_t nSize;
+};
+
+// counters of one size class, summed over all threads when a snapshot is taken
+struct MemoryPoolStats {
+	// size of blocks, 0 for requests larger than MAX_MEMORY_SIZE
+	size_t nSize;
+
+	// all requests, and the ones which went to heap because pool was at its limit or request was too large
+	long long nAlloc;
+	long long nHeap;
+
+	long long nFree;
 
-	// number of user accessing this block
-	int nRef;
+	// blocks in use, pool and heap
+	long long nLive;
 
-	// the memory pool it belongs to
-	MemoryPool* pPool;
+	// blocks taken from chunks, which is the peak of blocks in use and cached by threads
+	size_t nBlock;
 
-	// pointer to next block
-	MemoryBlock* pNext;
+	// limit of blocks pool grows to
+	size_t nMaxBlock;
 
-	// if the block is in pool
-	bool bPool;
-private:
+	// blocks on free list of pool, the others are in use or cached by threads
+	size_t nFreeBlock;
 
-	char padding[3];
+	// memory of chunks in bytes
+	size_t nChunkSize;
+};
+
+// snapshot of memory manager
+struct MemoryStats {
+	// one entry for each pool and a last one for large requests
+	MemoryPoolStats pools[MemoryClasses::count() + 1];
+
+	// threads which have requested memory and are still running
+	int nThreads;
+};
+
+// free blocks of one size class cached by a thread
+struct MemoryFreeList {
+	MemoryBlock* pHeader;
+
+	MemoryBlock* pTail;
+
+	// number of blocks in list
+	int nCount;
 };
 
 // memory pool
@@ -50,31 +125,93 @@ class MemoryPool {
 	public:
 		MemoryPool();
 
-		MemoryPool(size_t nSize, size_t nBlock);
+		// nMaxSize: limit of memory pool grows to in bytes
+		// nIndex: size class of pool, selects free list of thread caches
+		MemoryPool(size_t nSize, size_t nMaxSize, int nIndex);
 
 		~MemoryPool();
 
+		// set up an empty pool, nMaxSize: limit of memory pool grows to in bytes
+		// nIndex: size class of pool, selects free list of thread caches
+		void init(size_t nSize, size_t nMaxSize, int nIndex);
+
 		// request memroy and return it to manager
 		void* allocMem(size_t nSize);
 
 		// free memory
 		void freeMem(void* pMem);
 
-		void initMemory();
+		// give blocks cached by current thread back to pool
+		void releaseCache();
+
+		// limit memory pool grows to, chunks already added are kept
+		void setMaxSize(size_t nMaxSize);
+
+		// fill in size, chunks and free list of pool, counters of threads are added by manager
+		void getStats(MemoryPoolStats& stats);
+
+		// set up caches and counters of current thread, called on its first request
+		static void initThread();
+
+		// switch thread caches on or off, only threads which have not requested memory yet are affected
+		static void setThreadCache(bool bEnable);
 	private:
-		// address of memory pool
-		char* _pBuf;
+		// free list of current thread, nullptr when thread does not cache blocks
+		MemoryFreeList* getCache();
+
+		// take up to nCount blocks from pool with one lock, return number of blocks taken
+		int allocBatch(MemoryBlock*& pHead, MemoryBlock*& pTail, int nCount);
+
+		// put list of nCount blocks back into pool with one lock
+		void freeBatch(MemoryBlock* pHead, MemoryBlock* pTail, int nCount);
+
+		// memory requested from heap when pool is used up
+		MemoryBlock* allocHeap(size_t nSize);
+
+		// take a new block from newest chunk, nullptr when pool has reached its limit
+		MemoryBlock* newBlock();
+
+		// grow pool by one chunk, return false when system has no memory left
+		bool addChunk();
+
+		static size_t getPageSize();
+
+		// chunks of pool, newest first
+		MemoryChunk* _pChunk;
+
+		// part of newest chunk no block has been taken from yet
+		char* _pFree;
+		char* _pEnd;
 
 		// head of meomory block
 		MemoryBlock* _pHeader;
 
+		// number of blocks on free list
+		size_t _nFreeBlock;
+
+		// memory of all chunks in bytes
+		size_t _nChunkSize;
+
 		// size of each block
 		size_t _nSize;
 
-		// number of blocks in pool
+		// number of blocks taken from chunks
 		size_t _nBlock;
 
+		// most blocks pool grows to
+		size_t _nMaxBlock;
+
+		// size class of pool
+		int _nIndex;
+
+		// blocks moved between thread cache and pool at a time,
+		// a thread cache holding twice as many gives a batch back
+		int _nBatch;
+
+		// only taken when a thread cache is empty or full, or when pool grows
 		std::mutex _mutex;
+
+		static std::atomic<bool> _bThreadCache;
 };
 
 // memory manager
@@ -93,23 +230,27 @@ class MemoryMgr {
 		// free memory
 		void freeMem(void* pMem);
 
+		// share block with one more user, it is freed when every user has called freeMem, can be called from any thread
 		void addRef(void* pMem);
 
-	private:
-		// initialize mapping array
-		void init(int nBegin, int nEnd, MemoryPool* pMemP);
+		// give blocks cached by current thread back to pools, called when a thread exits
+		void releaseCache();
+
+		// switch thread caches on or off, only threads which have not requested memory yet are affected
+		void setThreadCache(bool bEnable);
+
+		// limit memory each pool grows to in bytes
+		void setMaxPoolSize(size_t nMaxSize);
+
+		// counters of all threads and state of pools, threads keep running while it is taken
+		MemoryStats getStats();
 
+	private:
 		// avoid user access manager directly
 		static MemoryMgr mgr;
-		
-		MemoryPool _pool64;
-		MemoryPool _pool128;
-		MemoryPool _pool256;
-		MemoryPool _pool512;
-		MemoryPool _pool1024;
-		 
-		// used to access the corresponding memory pool when request memory
-		MemoryPool* _szAlloc[MAX_MEMORY_SIZE + 1]; 
+
+		// one pool for each size class, a request goes to the pool of its class
+		MemoryPool _pools[MemoryClasses::count()];
 
 		// stop user trying to initialize manager
 		MemoryMgr();
@@ -117,4 +258,36 @@ class MemoryMgr {
 		~MemoryMgr();
 };
 
+// STL allocator which takes memory from memory manager, std::allocate_shared with it puts
+// the control block and the object into one pool block, without going through operator new
+template<class T>
+class MemoryAllocator {
+	public:
+		using value_type = T;
+
+		MemoryAllocator() noexcept {}
+
+		template<class U>
+		MemoryAllocator(const MemoryAllocator<U>&) noexcept {}
+
+		T* allocate(size_t n) {
+			return (T*)MemoryMgr::getInstance().allocMem(n * sizeof(T));
+		}
+
+		void deallocate(T* p, size_t) {
+			MemoryMgr::getInstance().freeMem(p);
+		}
+
+		// all instances share the same manager
+		template<class U>
+		bool operator==(const MemoryAllocator<U>&) const noexcept {
+			return true;
+		}
+
+		template<class U>
+		bool operator!=(const MemoryAllocator<U>&) const noexcept {
+			return false;
+		}
+};
+
 #endif
\ No newline at end of file
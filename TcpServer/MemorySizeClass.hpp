@@ -0,0 +1,68 @@
+#ifndef _MEMORY_SIZE_CLASS_HPP_
+#define _MEMORY_SIZE_CLASS_HPP_
+
+#include <stddef.h>
+
+#ifdef _MSC_VER
+#	include <intrin.h>
+#endif
+
+// spacing of smallest size classes, every block size is a multiple of it
+#define MEMORY_QUANTUM 16
+
+// number of size classes for every doubling of size above the smallest ones
+#define MEMORY_CLASS_GROUP 4
+
+// size classes of memory manager. the smallest classes are quantum apart up to 2 * group * quantum,
+// above that every doubling of size is split into group classes, so a request is rounded up
+// by at most 1 / group of its size (16, 32 ... 128, 160, 192, 224, 256, 320 ... 1024 by default).
+// quantum, group and maxSize must be powers of 2
+template<size_t quantum, size_t group, size_t maxSize>
+class MemorySizeClass {
+public:
+	// number of size classes
+	static constexpr int count() {
+		return (int)(2 * group + group * (floorLog2(maxSize) - floorLog2(linearSize())));
+	}
+
+	// block size of class index
+	static constexpr size_t size(int index) {
+		return index < (int)(2 * group) ? (index + 1) * quantum :
+			(linearSize() << ((index - 2 * group) / group)) + ((index - 2 * group) % group + 1) * ((linearSize() << ((index - 2 * group) / group)) / group);
+	}
+
+	// class of request, nSize must not be larger than maxSize
+	static int index(size_t nSize) {
+		if (nSize <= linearSize()) return nSize == 0 ? 0 : (int)((nSize - 1) / quantum);
+
+		// position of request in its doubling gives the class inside the group
+		int lg = highBit((unsigned)(nSize - 1));
+		return (int)(group + (lg - floorLog2(linearSize())) * group + ((nSize - 1) >> (lg - floorLog2(group))));
+	}
+
+private:
+	// largest size of classes which are quantum apart
+	static constexpr size_t linearSize() {
+		return 2 * group * quantum;
+	}
+
+	static constexpr int floorLog2(size_t n) {
+		return n > 1 ? 1 + floorLog2(n / 2) : 0;
+	}
+
+	// index of highest bit set, n must not be 0
+	static int highBit(unsigned n) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse(&index, n);
+		return (int)index;
+#else
+		return 31 - __builtin_clz(n);
+#endif
+	}
+
+	static_assert((quantum & (quantum - 1)) == 0 && (group & (group - 1)) == 0 && (maxSize & (maxSize - 1)) == 0, "size classes need powers of 2");
+	static_assert(maxSize >= 2 * group * quantum, "maxSize is smaller than classes which are quantum apart");
+};
+
+#endif // !_MEMORY_SIZE_CLASS_HPP_
@@ -1,4 +1,7 @@
 #include "Message.hpp"
+#include "MemoryMgr.hpp"
+
+#include <string.h>
 
 DataHeader::DataHeader() : length{ sizeof(DataHeader) }, cmd{ CMD_ERROR } {}
 
@@ -28,4 +31,87 @@ NewUserJoin::NewUserJoin(){
     length = sizeof(NewUserJoin);
     cmd = CMD_NEW_USER_JOIN;
     cSocket = 0;
-}
\ No newline at end of file
+}
+
+MessageView::MessageView(const DataHeader* header) : _header{ header } {}
+
+const DataHeader* MessageView::header() const {
+    return _header;
+}
+
+short MessageView::cmd() const {
+    return _header->cmd;
+}
+
+short MessageView::length() const {
+    return _header->length;
+}
+
+// copy message into memory pool, the copy can be kept and sent to other threads
+MsgBuf MessageView::retain() const {
+    return MsgBuf::copy(_header);
+}
+
+MsgBuf::MsgBuf() noexcept : _header{ nullptr } {}
+
+MsgBuf::MsgBuf(DataHeader* header) noexcept : _header{ header } {}
+
+MsgBuf::MsgBuf(const MsgBuf& other) noexcept : _header{ other._header } {
+    if (_header) MemoryMgr::getInstance().addRef(_header);
+}
+
+MsgBuf::MsgBuf(MsgBuf&& other) noexcept : _header{ other._header } {
+    other._header = nullptr;
+}
+
+MsgBuf& MsgBuf::operator=(const MsgBuf& other) noexcept {
+    // other may be this handle, so its block is taken before reset
+    DataHeader* header = other._header;
+    if (header) MemoryMgr::getInstance().addRef(header);
+    reset();
+    _header = header;
+    return *this;
+}
+
+MsgBuf& MsgBuf::operator=(MsgBuf&& other) noexcept {
+    if (this != &other) {
+        reset();
+        _header = other._header;
+        other._header = nullptr;
+    }
+    return *this;
+}
+
+MsgBuf::~MsgBuf() {
+    reset();
+}
+
+// copy of a complete message
+MsgBuf MsgBuf::copy(const DataHeader* header) {
+    void* pMem = allocBuf(header->length);
+    memcpy(pMem, header, header->length);
+    return MsgBuf((DataHeader*)pMem);
+}
+
+DataHeader* MsgBuf::get() const {
+    return _header;
+}
+
+DataHeader* MsgBuf::operator->() const {
+    return _header;
+}
+
+MsgBuf::operator bool() const {
+    return _header != nullptr;
+}
+
+// drop reference, handle becomes empty
+void MsgBuf::reset() {
+    // memory is returned to pool when last reference is released
+    if (_header) MemoryMgr::getInstance().freeMem(_header);
+    _header = nullptr;
+}
+
+void* MsgBuf::allocBuf(size_t nSize) {
+    return MemoryMgr::getInstance().allocMem(nSize);
+}
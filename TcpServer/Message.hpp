@@ -2,7 +2,10 @@
 #ifndef _MESSAGE_HEADER_HPP_
 #define _MESSAGE_HEADER_HPP_
 
-#include <memory>
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <type_traits>
 
 enum CMD {
     CMD_LOGIN,
@@ -47,6 +50,78 @@ struct NewUserJoin : public DataHeader {
     int cSocket;
 };
 
-using DataHeaderPtr = std::shared_ptr<DataHeader>;
+// message in a memory pool block, shared by the reference count in the block header instead of
+// a separate control block. copies are cheap and can be released on any thread, the block goes
+// back to its pool with the last one. content must not be changed once it is shared
+class MsgBuf {
+public:
+	MsgBuf() noexcept;
+
+	MsgBuf(const MsgBuf& other) noexcept;
+
+	MsgBuf(MsgBuf&& other) noexcept;
+
+	MsgBuf& operator=(const MsgBuf& other) noexcept;
+
+	MsgBuf& operator=(MsgBuf&& other) noexcept;
+
+	~MsgBuf();
+
+	// copy of a complete message
+	static MsgBuf copy(const DataHeader* header);
+
+	// message of type T constructed in a new block, to be filled in before it is shared
+	template<typename T, typename ...Args>
+	static MsgBuf create(Args&&...args) {
+		static_assert(std::is_base_of<DataHeader, T>::value && std::is_trivially_destructible<T>::value, "MsgBuf only holds plain messages");
+		return MsgBuf(new (allocBuf(sizeof(T))) T(std::forward<Args>(args)...));
+	}
+
+	DataHeader* get() const;
+
+	DataHeader* operator->() const;
+
+	explicit operator bool() const;
+
+	// drop reference, handle becomes empty
+	void reset();
+
+private:
+	// takes over block which has a reference count of 1
+	explicit MsgBuf(DataHeader* header) noexcept;
+
+	static void* allocBuf(size_t nSize);
+
+	DataHeader* _header;
+};
+
+// messages handed to handlers start at a multiple of this, so their fields can be read in place
+#define MESSAGE_ALIGN 8
+
+// view of a complete message inside receive buffer of a connection, no memory is allocated or copied
+// unless the message does not start at MESSAGE_ALIGN. it is only valid until OnNetMsg returns,
+// call retain() to keep the message after that
+class MessageView {
+public:
+	explicit MessageView(const DataHeader* header);
+
+	const DataHeader* header() const;
+
+	short cmd() const;
+
+	short length() const;
+
+	// access message as concrete type, return nullptr if message is shorter than the type
+	template<typename T>
+	const T* as() const {
+		return _header->length >= (short)sizeof(T) ? (const T*)_header : nullptr;
+	}
+
+	// copy message into memory pool, the copy can be kept and sent to other threads
+	MsgBuf retain() const;
+
+private:
+	const DataHeader* _header;
+};
 
 #endif
@@ -4,7 +4,10 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <mutex>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <utility>
 #include "Alloc.hpp"
 
 // DEBUG print
@@ -19,11 +22,35 @@
 	#endif // !xPrintf
 #endif
 
+// objects cached by each thread in front of the shared free list, half of them are moved at a time
+#define OBJECT_MAGAZINE_SIZE 16
+
+// counters of an object pool
+struct ObjectPoolStats {
+	// size of object and number of blocks in pool
+	size_t nSize;
+	size_t nBlock;
+
+	// all requests, and the ones which went to heap because pool was used up
+	long long nAlloc;
+	long long nHeap;
+
+	long long nFree;
+
+	// objects in use
+	long long nLive;
+
+	// blocks taken from pool at most, in use or cached by threads
+	long long nPeak;
+};
+
 // poolSize: number of block in object pool
+// free blocks are kept on a lock-free stack, and every thread caches a few of them in its magazine,
+// so most requests touch neither a lock nor a shared cache line
 template<typename T, size_t poolSize>
 class ObjectPool {
 	public:
-		ObjectPool() :_pBuf{ nullptr }, _pHeader{ nullptr } {
+		ObjectPool() :_pBuf{ nullptr }, _head{ 0 }, _nTaken{ 0 }, _nPeak{ 0 }, _nAlloc{ 0 }, _nHeap{ 0 }, _nFree{ 0 }, _pMagazines{ nullptr } {
 			initPool();
 		};
 
@@ -33,26 +60,36 @@ class ObjectPool {
 
 		// request object
 		void* allocMem(size_t nSize) {
-			std::lock_guard<std::mutex> lock(_mutex);
-
-			if (!_pBuf) initPool();
-
+			Magazine* pMagazine = getMagazine();
 			NodeHeader* pRet{ nullptr };
 
-			if (_pHeader == nullptr) {
+			if (pMagazine) {
+				if (pMagazine->nCount == 0) refill(pMagazine);
+				if (pMagazine->nCount > 0) pRet = pMagazine->nodes[--pMagazine->nCount];
+			}
+			else {
+				pRet = popNode();
+				if (pRet) takeNodes(1);
+			}
+
+			if (pRet == nullptr) {
 				pRet = (NodeHeader*)new char[sizeof(T) + sizeof(NodeHeader)];
 				pRet->bPool = false;
 				pRet->nID = -1;
 				pRet->nRef = 1;
 				pRet->pNext = nullptr;
+
+				if (pMagazine) countUp(pMagazine->nHeap);
+				else _nHeap++;
 			}
 			else {
-				pRet = _pHeader;
-				_pHeader = _pHeader->pNext;
 				assert(pRet->nRef == 0);
 				pRet->nRef = 1;
 			}
 
+			if (pMagazine) countUp(pMagazine->nAlloc);
+			else _nAlloc++;
+
 			xPrintf("allocMem: %llx, id=%d, size=%d \n", pRet, pRet->nID, nSize);
 
 			return ((char*)pRet + sizeof(NodeHeader));
@@ -66,28 +103,63 @@ class ObjectPool {
 
 			//assert(pBlock->nRef == 1);
 
-			std::lock_guard<std::mutex> lock(_mutex);
 			if (pBlock->nRef-- > 1) {
 				// memory block is accessed by more than 1 server
 				return;
 			}
 
-			if (pBlock->bPool) {
-				// set the current block as the first block to be used next time, manage memory pool as linklist
-				pBlock->pNext = _pHeader;
-				_pHeader = pBlock;
+			Magazine* pMagazine = getMagazine();
+
+			if (pMagazine) countUp(pMagazine->nFree);
+			else _nFree++;
+
+			if (!pBlock->bPool) {
+				// allocated as array of char, so it is released as one
+				delete[] (char*)pBlock;
+				return;
 			}
-			else {
-				
-				delete pBlock;
+
+			if (pMagazine == nullptr) {
+				pushNodes(pBlock, pBlock);
+				takeNodes(-1);
+				return;
 			}
+
+			// blocks freed by other threads than the one which requested them are cached here as well
+			if (pMagazine->nCount == OBJECT_MAGAZINE_SIZE) flush(pMagazine, OBJECT_MAGAZINE_SIZE / 2);
+			pMagazine->nodes[pMagazine->nCount++] = pBlock;
+		}
+
+		ObjectPoolStats getStats() {
+			ObjectPoolStats stats{};
+			stats.nSize = sizeof(T);
+			stats.nBlock = poolSize;
+			stats.nPeak = _nPeak;
+
+			// counters of running threads, the ones of exited threads are added to pool under the same lock
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+
+				stats.nAlloc = _nAlloc;
+				stats.nHeap = _nHeap;
+				stats.nFree = _nFree;
+
+				for (Magazine* pMagazine = _pMagazines; pMagazine; pMagazine = pMagazine->pNext) {
+					stats.nAlloc += pMagazine->nAlloc.load(std::memory_order_relaxed);
+					stats.nHeap += pMagazine->nHeap.load(std::memory_order_relaxed);
+					stats.nFree += pMagazine->nFree.load(std::memory_order_relaxed);
+				}
+			}
+
+			stats.nLive = stats.nAlloc - stats.nFree;
+			return stats;
 		}
 
 
 		class NodeHeader {
 			public:
-				// pointer to next
-				NodeHeader* pNext;
+				// pointer to next, read by other threads while they try to take a block from stack
+				std::atomic<NodeHeader*> pNext;
 
 				// id number 
 				int nID;
@@ -104,6 +176,33 @@ class ObjectPool {
 		};
 
 	private:
+		// blocks cached by one thread, and its counters which are only written by that thread
+		struct Magazine {
+			// pool magazine belongs to, a thread only caches blocks of the first pool of a type it uses
+			ObjectPool* pPool;
+
+			NodeHeader* nodes[OBJECT_MAGAZINE_SIZE];
+			int nCount;
+
+			// thread has exited, blocks go to stack directly
+			bool bReleased;
+
+			std::atomic<long long> nAlloc;
+			std::atomic<long long> nHeap;
+			std::atomic<long long> nFree;
+
+			Magazine* pPrev;
+			Magazine* pNext;
+		};
+
+		// gives cached blocks back when thread exits
+		class MagazineGuard {
+			public:
+				~MagazineGuard() {
+					if (tMagazine.pPool) tMagazine.pPool->releaseMagazine(&tMagazine);
+				}
+		};
+
 		// initialize pool
 		void initPool() {
 			assert(_pBuf == nullptr);
@@ -115,13 +214,13 @@ class ObjectPool {
 			_pBuf = new char[n];
 
 			// initialize object buffer
-			_pHeader = (NodeHeader*)_pBuf;
-			_pHeader->bPool = true;
-			_pHeader->nID = 0;
-			_pHeader->nRef = 0;
-			_pHeader->pNext = nullptr;
+			NodeHeader* pHeader = (NodeHeader*)_pBuf;
+			pHeader->bPool = true;
+			pHeader->nID = 0;
+			pHeader->nRef = 0;
+			pHeader->pNext = nullptr;
 
-			NodeHeader* pTemp1 = _pHeader;
+			NodeHeader* pTemp1 = pHeader;
 			 
 			for (size_t n = 1; n < poolSize; n++) {
 				NodeHeader* pTemp2 = (NodeHeader*)(_pBuf + (n * realSzie));
@@ -132,17 +231,219 @@ class ObjectPool {
 				pTemp1->pNext = pTemp2;
 				pTemp1 = pTemp2;
 			}
+
+			_head = makeHead(pHeader, 0);
+		}
+
+		// top of stack is stored as block index + 1 in low 32 bits, and a tag which changes
+		// with every update in high 32 bits, so a block which is taken and put back meanwhile
+		// does not make a stale compare-and-swap succeed
+		static unsigned long long makeHead(NodeHeader* pNode, unsigned long long oldHead) {
+			return (((oldHead >> 32) + 1) << 32) | (pNode ? (unsigned)pNode->nID + 1 : 0);
+		}
+
+		NodeHeader* nodeAt(unsigned long long head) {
+			unsigned index = (unsigned)head;
+			return index ? (NodeHeader*)(_pBuf + (index - 1) * (sizeof(T) + sizeof(NodeHeader))) : nullptr;
+		}
+
+		// take block from top of stack, nullptr when pool is used up
+		NodeHeader* popNode() {
+			unsigned long long head = _head.load(std::memory_order_acquire);
+
+			while (true) {
+				NodeHeader* pNode = nodeAt(head);
+				if (pNode == nullptr) return nullptr;
+
+				// blocks are never returned to system, so a block taken by another thread meanwhile can still be read
+				unsigned long long next = makeHead(pNode->pNext.load(std::memory_order_relaxed), head);
+				if (_head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) return pNode;
+			}
+		}
+
+		// put linked blocks from pFirst to pLast on top of stack
+		void pushNodes(NodeHeader* pFirst, NodeHeader* pLast) {
+			unsigned long long head = _head.load(std::memory_order_relaxed);
+
+			do {
+				pLast->pNext.store(nodeAt(head), std::memory_order_relaxed);
+			} while (!_head.compare_exchange_weak(head, makeHead(pFirst, head), std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		// count blocks taken from stack, and keep their peak
+		void takeNodes(long long n) {
+			long long taken = _nTaken.fetch_add(n) + n;
+			long long peak = _nPeak.load(std::memory_order_relaxed);
+
+			while (taken > peak && !_nPeak.compare_exchange_weak(peak, taken)) {}
 		}
 
-		NodeHeader* _pHeader;
+		// magazine of current thread, nullptr when thread caches blocks of another pool of this type or is exiting
+		Magazine* getMagazine() {
+			Magazine* pMagazine = &tMagazine;
+			if (pMagazine->pPool == this) return pMagazine;
+			if (pMagazine->pPool || pMagazine->bReleased) return nullptr;
+
+			// first use of guard registers its destructor for this thread
+			(void)&tGuard;
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			pMagazine->pPool = this;
+			pMagazine->pPrev = nullptr;
+			pMagazine->pNext = _pMagazines;
+			if (_pMagazines) _pMagazines->pPrev = pMagazine;
+			_pMagazines = pMagazine;
+			return pMagazine;
+		}
+
+		// fill empty magazine with half of its size
+		void refill(Magazine* pMagazine) {
+			while (pMagazine->nCount < OBJECT_MAGAZINE_SIZE / 2) {
+				NodeHeader* pNode = popNode();
+				if (pNode == nullptr) break;
+				pMagazine->nodes[pMagazine->nCount++] = pNode;
+			}
+
+			if (pMagazine->nCount > 0) takeNodes(pMagazine->nCount);
+		}
+
+		// give the n blocks freed first back to stack with one compare-and-swap
+		void flush(Magazine* pMagazine, int n) {
+			for (int i = 0; i < n - 1; i++) {
+				pMagazine->nodes[i]->pNext.store(pMagazine->nodes[i + 1], std::memory_order_relaxed);
+			}
+
+			pushNodes(pMagazine->nodes[0], pMagazine->nodes[n - 1]);
+			takeNodes(-n);
+
+			// blocks freed last stay, they are most likely still in cpu cache
+			for (int i = n; i < pMagazine->nCount; i++) {
+				pMagazine->nodes[i - n] = pMagazine->nodes[i];
+			}
+			pMagazine->nCount -= n;
+		}
+
+		// give blocks and counters of exiting thread back to pool
+		void releaseMagazine(Magazine* pMagazine) {
+			if (pMagazine->nCount > 0) flush(pMagazine, pMagazine->nCount);
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			_nAlloc += pMagazine->nAlloc;
+			_nHeap += pMagazine->nHeap;
+			_nFree += pMagazine->nFree;
+
+			if (pMagazine->pPrev) pMagazine->pPrev->pNext = pMagazine->pNext;
+			else _pMagazines = pMagazine->pNext;
+			if (pMagazine->pNext) pMagazine->pNext->pPrev = pMagazine->pPrev;
+
+			pMagazine->pPool = nullptr;
+			pMagazine->bReleased = true;
+		}
+
+		// counter only has one writer, so it needs no locked instruction
+		static void countUp(std::atomic<long long>& counter) {
+			counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
 
 		// buffer of object pool
 		char* _pBuf;
 
+		// top of stack of free blocks
+		std::atomic<unsigned long long> _head;
+
+		// blocks taken from stack now and at most
+		std::atomic<long long> _nTaken;
+		std::atomic<long long> _nPeak;
+
+		// counters of exited threads, and of threads which use another pool of this type
+		std::atomic<long long> _nAlloc;
+		std::atomic<long long> _nHeap;
+		std::atomic<long long> _nFree;
+
+		// magazines of running threads, only locked when a thread starts or exits and by getStats
 		std::mutex _mutex;
-		
+		Magazine* _pMagazines;
+
+		static thread_local Magazine tMagazine;
+		static thread_local MagazineGuard tGuard;
 };
 
+// plain data without constructor, so it can still be used by destructors running after its guard
+template<typename T, size_t poolSize>
+thread_local typename ObjectPool<T, poolSize>::Magazine ObjectPool<T, poolSize>::tMagazine;
+
+template<typename T, size_t poolSize>
+thread_local typename ObjectPool<T, poolSize>::MagazineGuard ObjectPool<T, poolSize>::tGuard;
+
+// STL allocator which takes single objects from an object pool of their own type, and arrays from heap.
+// std::allocate_shared rebinds it to the type of its control block, so the control block and the object
+// share one pool block. Owner is the type shared pointers are made for, the pool can be found by it
+template<typename T, size_t poolSize, typename Owner = T>
+class ObjectPoolAllocator {
+	public:
+		using value_type = T;
+
+		template<typename U>
+		struct rebind {
+			using other = ObjectPoolAllocator<U, poolSize, Owner>;
+		};
+
+		ObjectPoolAllocator() noexcept {}
+
+		template<typename U>
+		ObjectPoolAllocator(const ObjectPoolAllocator<U, poolSize, Owner>&) noexcept {}
+
+		T* allocate(size_t n) {
+			if (n != 1) return (T*)mem_alloc(n * sizeof(T));
+			return (T*)getPool().allocMem(sizeof(T));
+		}
+
+		void deallocate(T* p, size_t n) {
+			if (n != 1) mem_free(p);
+			else getPool().freeMem(p);
+		}
+
+		// counters of the pool blocks for Owner come from, all zero before the first one is requested
+		static ObjectPoolStats getPoolStats() {
+			ObjectPoolStats (*getStats)() = ObjectPoolAllocator<Owner, poolSize, Owner>::_getStats.load();
+			return getStats ? getStats() : ObjectPoolStats{};
+		}
+
+		// all instances of a type share the same pool
+		template<typename U>
+		bool operator==(const ObjectPoolAllocator<U, poolSize, Owner>&) const noexcept {
+			return true;
+		}
+
+		template<typename U>
+		bool operator!=(const ObjectPoolAllocator<U, poolSize, Owner>&) const noexcept {
+			return false;
+		}
+
+	private:
+		template<typename, size_t, typename>
+		friend class ObjectPoolAllocator;
+
+		static ObjectPool<T, poolSize>& getPool() {
+			static ObjectPool<T, poolSize> pool;
+
+			// rebound type is only known inside the standard library, so the pool is made known under Owner
+			static bool bShown = (ObjectPoolAllocator<Owner, poolSize, Owner>::_getStats.store(&getStats), true);
+			(void)bShown;
+
+			return pool;
+		}
+
+		static ObjectPoolStats getStats() {
+			return getPool().getStats();
+		}
+
+		static std::atomic<ObjectPoolStats (*)()> _getStats;
+};
+
+template<typename T, size_t poolSize, typename Owner>
+std::atomic<ObjectPoolStats (*)()> ObjectPoolAllocator<T, poolSize, Owner>::_getStats{ nullptr };
+
 // set default pool size to 10
 template<typename T, size_t poolSize = 10>
 class ObjectPoolBase {
@@ -174,6 +475,23 @@ class ObjectPoolBase {
 			delete p;
 		}
 
+		// create object owned by shared pointer, object and control block are taken as one block
+		// from a pool of their own, so operator new above is not used for it
+		template<typename ...Args>
+		static std::shared_ptr<T> createShared(Args&&...args) {
+			return std::allocate_shared<T>(ObjectPoolAllocator<T, poolSize>(), std::forward<Args>(args)...);
+		}
+
+		// counters of pool of T
+		static ObjectPoolStats getPoolStats() {
+			return getInstance().getStats();
+		}
+
+		// counters of pool of objects made by createShared
+		static ObjectPoolStats getSharedPoolStats() {
+			return ObjectPoolAllocator<T, poolSize>::getPoolStats();
+		}
+
 		~ObjectPoolBase() {}
 
 	private:
@@ -1,13 +1,38 @@
 #include "TcpServer.hpp"
 
-EasyTcpServer::EasyTcpServer() :_sock{ INVALID_SOCKET }, 
-								_clients_list{},
-								_time{},
-								_recvCount{ 0 },
-								_msgCount{ 0 },
+#include <algorithm>
+
+#ifndef _WIN32
+#	include <sys/resource.h>
+#	include <signal.h>
+#endif
+
+EasyTcpServer::EasyTcpServer() :_recvCount{ 0 },
 								_clientCount{ 0 },
+								_msgCount{ 0 },
+								_blockedCount{ 0 },
+								_migrateCount{ 0 },
+								_acceptCount{ 0 },
+								_acceptWakeups{ 0 },
+								_clients{},
+								isRunning{ true },
+								_sock{ INVALID_SOCKET },
+								_executor{},
+								_workerThreads{ 0 },
+								_cpus{},
 								_child_servers{},
-								isRunning{ true }
+								_balancer{ CellBalancer::create(CellBalancerType::LeastConnections) },
+								_rebalance{ false },
+								_imbalanceWindows{ 0 },
+								_pollerType{ CellPollerType::Default },
+								_sendConfig{},
+								_ioEngine{ CellIoEngine::Reactor },
+								_reusePort{ false },
+								_acceptBatch{ 128 },
+								_ip{},
+								_port{ 0 },
+								_backlog{ 0 },
+								_time{}
 								{}
 
 // initialize server socket
@@ -19,6 +44,17 @@ SOCKET EasyTcpServer::initSocket() {
 
 	// initiates use of the Winsock DLL by program.
 	WSAStartup(ver, &dat);
+#		else
+	// each client takes a file descriptor, raise the soft limit (usually 1024)
+	// to the hard limit so that one process can hold far more connections
+	rlimit lim = {};
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
+
+	// writing to a connection closed by peer should fail with EPIPE instead of killing the server
+	signal(SIGPIPE, SIG_IGN);
 #		endif
 
 	// 1.build a socket
@@ -52,6 +88,18 @@ int EasyTcpServer::bindPort(const char* ip, unsigned short port) {
 		initSocket();
 	}
 
+	// allow restarting server while connections of previous process are in TIME_WAIT
+	int opt = 1;
+	setsockopt(_sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&opt, sizeof(opt));
+
+#		ifdef SO_REUSEPORT
+	// several sockets can listen on the same port, kernel spreads connections among them
+	if (_reusePort) setsockopt(_sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&opt, sizeof(opt));
+#		endif
+
+	_ip = ip ? ip : "";
+	_port = port;
+
 	// same struct compared with the standard argument type of bind function, we use type conversion to convert its type
 	sockaddr_in _sin = {};
 	_sin.sin_family = AF_INET;
@@ -95,6 +143,10 @@ int EasyTcpServer::bindPort(const char* ip, unsigned short port) {
 // defines the maximum length to the queue of pending connections
 int EasyTcpServer::listenNumber(int n) {
 	int ret = listen(_sock, n);
+	_backlog = n;
+
+	// pending connections are drained until accept would block
+	setNonBlocking(_sock);
 
 	if (SOCKET_ERROR == ret) {
 		std::cout << "ERROR, socket " << _sock << " listen to port failed" << std::endl;
@@ -108,52 +160,69 @@ int EasyTcpServer::listenNumber(int n) {
 
 // accept client connection
 SOCKET EasyTcpServer::acceptClient() {
-	// 4. wait until accept an new client connection
-	// The accept function fills this structure with the address information of the client that is connecting.
-	sockaddr_in clientAddr = {};
+	// 4. accept an new client connection, listening socket is non-blocking,
+	// so INVALID_SOCKET is returned when no connection is pending
+	SOCKET cSock = acceptNonBlocking(_sock);
 
-	// After the function call, it will be updated with the actual size of the client's address information.
-	int nAddrLen = sizeof(clientAddr);
+	if (INVALID_SOCKET == cSock && !isWouldBlock() && !isInterrupted()) {
+		std::cout << "ERROR:Invalid Socket " << _sock << " accepted" << std::endl;
+	}
 
-	SOCKET cSock = INVALID_SOCKET;
+	return cSock;
+}
 
-#		ifdef _WIN32
-	cSock = accept(_sock, (sockaddr*)&clientAddr, &nAddrLen);
-#		else
-	cSock = accept(_sock, (sockaddr*)&clientAddr, (socklen_t*)&nAddrLen);
-#		endif
+// accept pending connections until there is none or cap of one wakeup is reached,
+// return number of accepted connections
+int EasyTcpServer::acceptClients() {
+	std::vector<ClientPtr> clients;
+
+	while ((int)clients.size() < _acceptBatch) {
+		SOCKET cSock = acceptClient();
+		if (INVALID_SOCKET == cSock) {
+			if (isInterrupted()) continue;
+			break;
+		}
 
-	if (INVALID_SOCKET == cSock) {
-		std::cout << "ERROR:Invalid Socket " << _sock << " accepted" << std::endl;
-	}
-	else {
 		// send message to all client that there is an new client connected to server
 		// NewUserJoin client;
 		// client.cSocket = cSock; 
 		//broadcastMessage(&client);
 
-		// choose a child server which has least clients
-		// call the overload new to request memory
-		ClientPtr c(new Client(cSock));
-		// addClientToChild(std::make_shared<Client>(cSock));
-		addClientToChild(c);
+		// client and its shared pointer control block are one block of client pool
+		clients.push_back(Client::createShared(cSock));
 	}
 
-	return cSock;
+	// hand all connections of this wakeup to child servers at once
+	if (!clients.empty()) addClientsToChild(clients);
+
+	_acceptCount += (int)clients.size();
+	_acceptWakeups++;
+
+	return (int)clients.size();
 }
 
-void EasyTcpServer::addClientToChild(ClientPtr client) {
-	// Least connection method to assign client to one of the child server
-	auto minClientServer = _child_servers[0];
+// assign clients accepted in one wakeup to child servers
+void EasyTcpServer::addClientsToChild(std::vector<ClientPtr>& clients) {
+	// every client is handed over as soon as it is assigned, so balancer sees it in load of the child,
+	// children are only woken up once for the whole batch
+	std::vector<bool> woken(_child_servers.size(), false);
 
-	for (auto childServer : _child_servers) {
-		if (minClientServer->getCount() > childServer->getCount()) {
-			minClientServer = childServer;
-		}
+	for (auto& client : clients) {
+		size_t n = _balancer->pick(_child_servers);
+
+		OnJoin(client);
+		_child_servers[n]->addClient(client, false);
+		woken[n] = true;
 	}
 
-	minClientServer->addClient(client);
-	OnJoin(client);
+	for (size_t n = 0; n < woken.size(); n++) {
+		if (woken[n]) _child_servers[n]->wakeup();
+	}
+}
+
+// maximum number of connections accepted in one wakeup of main thread
+void EasyTcpServer::setAcceptBatch(int n) {
+	_acceptBatch = n > 0 ? n : 1;
 }
 
 // listen client message
@@ -162,6 +231,18 @@ bool EasyTcpServer::onRun() {
 
 	recvMsgRate();
 
+	// child servers accept connections on their own listening sockets,
+	// main thread only wakes up to print stats when next window is over
+	if (_reusePort && !_child_servers.empty()) {
+		double left = 1.0 - _time.getElapsedSecond();
+		if (left > 0) std::this_thread::sleep_for(std::chrono::microseconds((long long)(left * 1000000)));
+		return true;
+	}
+
+#	ifdef CELL_HAS_IO_URING
+	if (_uring) return acceptUring();
+#	endif
+
 	// fd_set: to place sockets into a "set" for various purposes, such as testing a given socket for readability using the readfds parameter of the select function
 	fd_set fdRead;
 	fd_set fdWrite;
@@ -206,14 +287,188 @@ bool EasyTcpServer::onRun() {
 		// Clears the bit for the file descriptor fd in the file descriptor set fdRead, so that we can .
 		FD_CLR(_sock, &fdRead);
 
-		// accept connection from client
-		acceptClient();
+		// accept all pending connections from clients
+		acceptClients();
 	}
 
 	return true;
 	//std::cout << "Server is idle and able to deal with other tasks" << std::endl;
 }
 
+// choose readiness backend of child servers, must be called before Start()
+void EasyTcpServer::setPollerType(CellPollerType type) {
+	_pollerType = type;
+}
+
+// choose how sockets are accepted and read, must be called before Start()
+void EasyTcpServer::setIoEngine(CellIoEngine engine) {
+	_ioEngine = engine;
+}
+
+// limits of unsent data of each client and what to do with slow clients, must be called before Start()
+void EasyTcpServer::setSendConfig(const CellSendConfig& config) {
+	_sendConfig = config;
+}
+
+// choose how accepted clients are spread over child servers, must be called before Start()
+void EasyTcpServer::setBalancer(CellBalancerType type) {
+	_balancer = CellBalancer::create(type);
+}
+
+// move busy clients away from a child server whose message rate stays far above average,
+// not supported by io_uring engine, must be called before Start()
+void EasyTcpServer::setRebalance(bool enable) {
+	_rebalance = enable;
+}
+
+// ask busiest child server to hand clients to idlest one when imbalance lasts, called after load is sampled
+void EasyTcpServer::rebalance() {
+	auto& loads = _balancer->getLoads();
+	if (loads.size() < 2) return;
+
+	size_t maxIndex = 0;
+	size_t minIndex = 0;
+	double total = 0;
+
+	for (size_t n = 0; n < loads.size(); n++) {
+		total += loads[n].msgsPerSec;
+		if (loads[n].msgsPerSec > loads[maxIndex].msgsPerSec) maxIndex = n;
+		if (loads[n].msgsPerSec < loads[minIndex].msgsPerSec) minIndex = n;
+	}
+
+	double average = total / loads.size();
+	double gap = loads[maxIndex].msgsPerSec - loads[minIndex].msgsPerSec;
+
+	// short bursts and light load are not worth moving clients for
+	if (loads[maxIndex].msgsPerSec < average * CELL_REBALANCE_RATIO || gap < CELL_REBALANCE_MIN_MSGS) {
+		_imbalanceWindows = 0;
+		return;
+	}
+
+	if (++_imbalanceWindows < CELL_REBALANCE_WINDOWS) return;
+
+	// half of the gap evens out the two children, rates are measured again before next move
+	_child_servers[maxIndex]->requestMigration(_child_servers[minIndex].get(), gap / 2);
+	_imbalanceWindows = 0;
+}
+
+// pin child server n to cpus[n % cpus.size()] and handler workers to the cpus after those of child servers,
+// empty to leave threads to scheduler, must be called before Start()
+void EasyTcpServer::setCpuAffinity(const std::vector<int>& cpus) {
+	_cpus = cpus;
+}
+
+// pin child servers and workers to cpus of a numa node, return false when node is unknown, must be called before Start()
+bool EasyTcpServer::setNumaNode(int node) {
+	std::vector<int> cpus = CellAffinity::getNodeCpus(node);
+
+	if (cpus.empty()) {
+		std::cout << "cpus of numa node " << node << " are unknown, threads are not pinned" << std::endl;
+		return false;
+	}
+
+	setCpuAffinity(cpus);
+	return true;
+}
+
+// pin child servers and workers to cpus of the numa node network interface is attached to, so packets, threads and
+// their buffers stay on one socket, return false when node is unknown, must be called before Start()
+bool EasyTcpServer::setNicAffinity(const char* ifname) {
+	int node = CellAffinity::getNicNode(ifname);
+
+	if (node < 0) {
+		std::cout << "numa node of " << ifname << " is unknown, threads are not pinned" << std::endl;
+		return false;
+	}
+
+	return setNumaNode(node);
+}
+
+// run OnNetMsg on a pool of nThreads workers instead of I/O threads, 0 to disable, must be called before Start()
+void EasyTcpServer::setWorkerThreads(int nThreads) {
+	_workerThreads = nThreads;
+}
+
+#ifdef CELL_HAS_IO_URING
+// accept connections with multishot accept
+bool EasyTcpServer::acceptUring() {
+	// wait at most 1 millisecond so that message rate can still be reported
+	if (_uring->submitAndWait(1) < 0) {
+		std::cout << "=================" << std::endl;
+		std::cout << "Exception happens" << std::endl;
+		std::cout << "=================" << std::endl;
+		closeSock();
+		return false;
+	}
+
+	std::vector<ClientPtr> clients;
+
+	while (io_uring_cqe* cqe = _uring->peekCqe()) {
+		int res = cqe->res;
+		unsigned flags = cqe->flags;
+		_uring->seenCqe();
+
+		if (res >= 0) {
+			// client and its shared pointer control block are one block of client pool
+			clients.push_back(Client::createShared(res));
+		}
+		else {
+			std::cout << "ERROR:Invalid Socket " << _sock << " accepted" << std::endl;
+		}
+
+		// multishot accept is terminated by kernel, start it again
+		if (!(flags & IORING_CQE_F_MORE)) _uring->prepAcceptMultishot(_sock, 0);
+	}
+
+	// hand all connections of this wakeup to child servers at once
+	if (!clients.empty()) {
+		addClientsToChild(clients);
+
+		_acceptCount += (int)clients.size();
+		_acceptWakeups++;
+	}
+
+	return true;
+}
+#endif
+
+// let every child server accept on its own SO_REUSEPORT listening socket, so that kernel
+// spreads connections over threads, must be called before bindPort()
+void EasyTcpServer::setReusePort(bool enable) {
+#	ifdef SO_REUSEPORT
+	_reusePort = enable;
+#	else
+	if (enable) std::cout << "SO_REUSEPORT is not supported, connections are accepted by main thread" << std::endl;
+#	endif
+}
+
+// create one more listening socket bound to the same address as server socket
+SOCKET EasyTcpServer::createReusePortSock() {
+	SOCKET sock = INVALID_SOCKET;
+
+#	ifdef SO_REUSEPORT
+	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (INVALID_SOCKET == sock) return sock;
+
+	int opt = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&opt, sizeof(opt));
+	setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&opt, sizeof(opt));
+
+	sockaddr_in _sin = {};
+	_sin.sin_family = AF_INET;
+	_sin.sin_port = htons(_port);
+	_sin.sin_addr.s_addr = _ip.empty() ? INADDR_ANY : inet_addr(_ip.c_str());
+
+	if (SOCKET_ERROR == bind(sock, (sockaddr*)&_sin, sizeof(sockaddr_in)) || SOCKET_ERROR == listen(sock, _backlog)) {
+		std::cout << "ERROR, cannot create listening socket on port: " << _port << std::endl;
+		close(sock);
+		return INVALID_SOCKET;
+	}
+#	endif
+
+	return sock;
+}
+
 // start child server to process client message
 void EasyTcpServer::Start(int childCount) {
 	if (_sock == INVALID_SOCKET) {
@@ -221,10 +476,63 @@ void EasyTcpServer::Start(int childCount) {
 		return;
 	}
 
+	if (_ioEngine == CellIoEngine::IoUring) {
+		bool supported = false;
+
+#		ifdef CELL_HAS_IO_URING
+		if (CellUring::isSupported()) {
+			supported = true;
+
+			// main thread does not accept when child servers have their own listening sockets
+			if (!_reusePort) {
+				_uring.reset(new CellUring());
+				supported = _uring->init(64, 0, 0) && _uring->prepAcceptMultishot(_sock, 0);
+
+				if (!supported) _uring.reset();
+			}
+		}
+#		endif
+
+		// child servers cannot use io_uring either, keep them consistent with main server
+		if (!supported) {
+			std::cout << "io_uring is not supported, fall back to reactor engine" << std::endl;
+			_ioEngine = CellIoEngine::Reactor;
+		}
+	}
+
+	// a multishot recv of io_uring cannot be handed to another ring, so clients stay where they are
+	if (_rebalance && _ioEngine == CellIoEngine::IoUring) std::cout << "rebalancing is not supported by io_uring engine" << std::endl;
+
+	if (_workerThreads > 0) {
+		_executor.reset(new CellExecutor(_workerThreads));
+
+		// workers come after child servers in cpu list, so they only share cores with I/O threads
+		// when there are fewer cpus than threads
+		if (!_cpus.empty()) {
+			std::vector<int> cpus;
+			for (int n = 0; n < _workerThreads; n++) {
+				cpus.push_back(_cpus[(childCount + n) % _cpus.size()]);
+			}
+			_executor->setCpus(cpus);
+		}
+
+		_executor->start();
+	}
+
 	for (int n = 0; n < childCount; n++) {
-		auto cServer = std::make_shared<ChildServer>(_sock);
+		auto cServer = std::make_shared<ChildServer>(_sock, _pollerType, _ioEngine);
 		_child_servers.push_back(cServer);
 		cServer->setMainServer(this);
+		cServer->setSendConfig(_sendConfig);
+		cServer->setExecutor(_executor.get());
+		if (!_cpus.empty()) cServer->setCpu(_cpus[n % _cpus.size()]);
+
+		if (_reusePort) {
+			// first child server takes over server socket, the others get their own sockets
+			SOCKET listenSock = n == 0 ? _sock : createReusePortSock();
+			if (listenSock != INVALID_SOCKET) cServer->setListenSock(listenSock);
+		}
+
 		cServer->start();
 	}
 }
@@ -245,7 +553,7 @@ void EasyTcpServer::closeSock() {
 	close(_sock);
 #		endif
 
-	_clients_list.clear();
+	_clients.clear();
 }
 
 // check if socket is created
@@ -261,34 +569,102 @@ void EasyTcpServer::recvMsgRate() {
 		std::cout << "Threads: " << _child_servers.size() << " - ";
 		std::cout << "Clients: " << _clientCount << " - ";
 		std::cout << std::fixed << std::setprecision(6) << t << " second, server socket <" << _sock;
-		std::cout << "> receive " << (int)(_recvCount / t) << " packets, " << int(_msgCount / t) << " messages" << std::endl;
+		std::cout << "> receive " << (int)(_recvCount / t) << " packets, " << int(_msgCount / t) << " messages";
+
+		// child servers accept on their own listening sockets in reuseport mode
+		for (auto& child : _child_servers) {
+			int nAccepts = 0;
+			int nWakeups = 0;
+			child->takeAcceptStats(nAccepts, nWakeups);
+
+			_acceptCount += nAccepts;
+			_acceptWakeups += nWakeups;
+		}
+
+		// a connection storm is drained in few wakeups when accepts are batched
+		if (_acceptWakeups > 0) {
+			std::cout << ", accept " << std::setprecision(2) << (double)_acceptCount / _acceptWakeups << " per wakeup";
+		}
+
+		if (_blockedCount > 0) std::cout << ", " << _blockedCount << " clients blocked on send";
+
+		if (_migrateCount > 0) std::cout << ", " << _migrateCount << " clients migrated";
+
+		// tasks are only reported when handlers run on worker threads
+		if (_executor) {
+			CellExecutorStats stats = _executor->takeStats();
+
+			if (stats.count > 0 || stats.depth > 0) {
+				std::cout << ", tasks " << (int)(stats.count / t) << " queued " << stats.depth;
+				if (stats.count > 0) std::cout << " latency avg " << stats.totalLatencyUs / stats.count << "us max " << stats.maxLatencyUs << "us";
+			}
+		}
+
+		std::cout << std::endl;
+
+		// clients and traffic of each child server, to check how well balancer spreads load
+		_balancer->sample(_child_servers, t);
+
+		if (_rebalance && _ioEngine != CellIoEngine::IoUring) rebalance();
+
+		if (_clientCount > 0) {
+			std::cout << "Balance (" << (_reusePort ? "kernel" : _balancer->name()) << "):";
+
+			for (auto& load : _balancer->getLoads()) {
+				std::cout << " [" << load.clients << " clients " << std::setprecision(0) << load.msgsPerSec << " msg/s "
+						  << std::setprecision(1) << load.bytesPerSec / 1024 << " KB/s]";
+			}
+			std::cout << std::endl;
+		}
 
 		_msgCount = 0;
 		_recvCount = 0;
+		_acceptCount = 0;
+		_acceptWakeups = 0;
 		_time.update();
 	}
 }
 
-// send message to client
-int EasyTcpServer::sendMessage(SOCKET cSock, DataHeader* header) {
-	if (isRun() && header) {
-		return send(cSock, (const char*)header, header->length, 0);
-	}
+// send message to client of id from any thread, message is copied and queued to the client,
+// its child server sends it without blocking caller. return SOCKET_ERROR when client has exited
+// or message is dropped by send budget
+int EasyTcpServer::sendMessage(unsigned long long id, const DataHeader* header) {
+	if (!isRun() || !header) return SOCKET_ERROR;
+
+	// only thread of child server writes to socket, so messages are never interleaved
+	ClientPtr client = findClient(id);
+	if (!client) return SOCKET_ERROR;
 
-	return SOCKET_ERROR;
+	return client->sendMessage(MsgBuf::copy(header));
 }
 
-// broadcast message to all users in server
-void EasyTcpServer::broadcastMessage(DataHeader* header) {
-	if (isRun() && header) {
-		for (int n = (int)_clients_list.size() - 1; n >= 0; n--) {
-			sendMessage(_clients_list[n]->getSockfd(), header);
-		}
+// broadcast message to all users in server, message is copied into a pool block once and
+// shared by all child servers, which queue it to their clients without blocking caller
+void EasyTcpServer::broadcastMessage(const DataHeader* header) {
+	if (isRun() && header) broadcastMessage(MsgBuf::copy(header));
+}
+
+void EasyTcpServer::broadcastMessage(const MsgBuf& msg) {
+	if (!isRun() || !msg) return;
+
+	// one fan-out per child server, each sends to its own clients on its own thread
+	for (auto& child : _child_servers) {
+		child->addBroadcast(msg);
 	}
 }
 
+// connected client of id, nullptr when it has exited, called by any thread
+ClientPtr EasyTcpServer::findClient(unsigned long long id) {
+	return _clients.find(id);
+}
+
+// copy of all connected clients, called by any thread
+void EasyTcpServer::getClients(std::vector<ClientPtr>& clients) {
+	_clients.snapshot(clients);
+}
+
 // increase number of received packages
-void EasyTcpServer::OnNetMsg(ChildServer* pChildServer, ClientPtr& clientSock, DataHeaderPtr header) {
+void EasyTcpServer::OnNetMsg(ChildServer* pChildServer, ClientPtr& clientSock, const MessageView& msg) {
 	_msgCount++;
 }
 
@@ -296,25 +672,35 @@ void EasyTcpServer::OnNetRecv(ClientPtr& clientSock) {
 	_recvCount++;
 }
 
+// messages are only counted, cheap enough to be handled on I/O thread
+bool EasyTcpServer::isInlineMsg(ChildServer* pChildServer, ClientPtr& clientSock, const MessageView& msg) {
+	return true;
+}
+
 // new client connect server
 void EasyTcpServer::OnJoin(ClientPtr& clientSock) {
-	_clients_list.push_back(clientSock);
+	_clients.insert(clientSock);
 	_clientCount++;
 }
 
 // delete the socket of exited client
 void EasyTcpServer::OnExit(ClientPtr& clientSock) {
-	auto iter = _clients_list.end();
+	_clients.erase(clientSock->getId());
+	_clientCount--;
+}
 
-	for (int n = (int)_clients_list.size() - 1; n >= 0; n--) {
-		if (_clients_list[n] == clientSock) {
-			iter = _clients_list.begin() + n;
-		}
-	}
+// count clients which do not read their data fast enough
+void EasyTcpServer::OnWriteBlocked(ChildServer* pChildServer, ClientPtr& clientSock) {
+	_blockedCount++;
+}
 
-	if (iter != _clients_list.end()) _clients_list.erase(iter);
+void EasyTcpServer::OnWriteDrained(ChildServer* pChildServer, ClientPtr& clientSock) {
+	_blockedCount--;
+}
 
-	_clientCount--;
+// count clients moved between child servers
+void EasyTcpServer::OnMigrate(ChildServer* pFrom, ChildServer* pTo, ClientPtr& clientSock) {
+	_migrateCount++;
 }
 
 EasyTcpServer::~EasyTcpServer() {
@@ -331,8 +717,62 @@ void cmdThread(EasyTcpServer& Server) {
 			Server.isRunning = false;
 			break;
 		}
+		else if (strcmp(cmdBuf, "mem") == 0) {
+			printMemoryStats();
+		}
+		else if (strcmp(cmdBuf, "clients") == 0) {
+			printClients(Server);
+		}
 		else {
 			std::cout << "not valid command" << std::endl;
 		}
 	}
-}
\ No newline at end of file
+}
+
+// print counters of memory manager and object pools, so pools can be sized from real traffic
+void printMemoryStats() {
+	MemoryStats stats = MemoryMgr::getInstance().getStats();
+
+	std::cout << "memory pools, " << stats.nThreads << " threads:" << std::endl;
+	std::cout << std::setw(8) << "size" << std::setw(14) << "requests" << std::setw(12) << "heap"
+		<< std::setw(10) << "live" << std::setw(10) << "peak" << std::setw(10) << "free" << std::setw(10) << "limit" << std::setw(10) << "KB" << std::endl;
+
+	for (auto& pool : stats.pools) {
+		// requests larger than any block are listed last
+		if (pool.nSize > 0) std::cout << std::setw(8) << pool.nSize;
+		else std::cout << std::setw(8) << "large";
+
+		std::cout << std::setw(14) << pool.nAlloc << std::setw(12) << pool.nHeap << std::setw(10) << pool.nLive
+			<< std::setw(10) << pool.nBlock << std::setw(10) << pool.nFreeBlock << std::setw(10) << pool.nMaxBlock
+			<< std::setw(10) << pool.nChunkSize / 1024 << std::endl;
+	}
+
+	ObjectPoolStats clients = Client::getSharedPoolStats();
+
+	std::cout << "client pool, " << clients.nBlock << " blocks of " << clients.nSize << " bytes: " << clients.nAlloc << " requests, "
+		<< clients.nHeap << " from heap, " << clients.nLive << " live, peak " << clients.nPeak << std::endl;
+}
+
+// print number of connections and the ones with most unsent data
+void printClients(EasyTcpServer& Server) {
+	std::vector<ClientPtr> clients;
+	Server.getClients(clients);
+
+	std::vector<std::pair<int, ClientPtr>> queued;
+	queued.reserve(clients.size());
+
+	for (auto& client : clients) {
+		queued.emplace_back(client->getSendSize(), client);
+	}
+
+	// slow readers are listed first
+	size_t nShown = queued.size() < 10 ? queued.size() : 10;
+	std::partial_sort(queued.begin(), queued.begin() + nShown, queued.end(),
+		[](const std::pair<int, ClientPtr>& a, const std::pair<int, ClientPtr>& b) { return a.first > b.first; });
+
+	std::cout << clients.size() << " clients connected" << std::endl;
+
+	for (size_t n = 0; n < nShown; n++) {
+		std::cout << "client " << queued[n].second->getId() << ", socket " << queued[n].second->getSockfd() << ": " << queued[n].first << " bytes unsent" << std::endl;
+	}
+}
@@ -14,13 +14,26 @@
 
 #include "Cell.hpp"
 #include "ObjectPool.hpp"
+#include "MemoryMgr.hpp"
 #include "Message.hpp"
 #include "CELLTimestamp.hpp"
 #include "CELLTask.hpp"
 #include "Client.hpp"
 #include "ChildServer.hpp"
+#include "CELLBalancer.hpp"
+#include "CELLAffinity.hpp"
+#include "CELLClientRegistry.hpp"
 #include "INetEvent.hpp"
 
+// a child server is rebalanced when its message rate stays this many times above average
+#define CELL_REBALANCE_RATIO 1.5
+
+// for this many stats windows (seconds) in a row
+#define CELL_REBALANCE_WINDOWS 3
+
+// and exceeds rate of idlest child by at least this many messages per second
+#define CELL_REBALANCE_MIN_MSGS 1000
+
 class EasyTcpServer : public INetEvent{
 public:
 
@@ -38,11 +51,53 @@ public:
 	// accept client connection
 	SOCKET acceptClient();
 
-	void addClientToChild(ClientPtr client);
+	// accept pending connections until there is none or cap of one wakeup is reached,
+	// return number of accepted connections
+	int acceptClients();
+
+	// assign clients accepted in one wakeup to child servers
+	void addClientsToChild(std::vector<ClientPtr>& clients);
+
+	// maximum number of connections accepted in one wakeup of main thread
+	void setAcceptBatch(int n);
 
 	// listen client message
 	bool onRun();
 
+	// choose readiness backend of child servers, must be called before Start()
+	void setPollerType(CellPollerType type);
+
+	// choose how sockets are accepted and read, must be called before Start()
+	void setIoEngine(CellIoEngine engine);
+
+	// let every child server accept on its own SO_REUSEPORT listening socket, so that kernel
+	// spreads connections over threads, must be called before bindPort()
+	void setReusePort(bool enable);
+
+	// limits of unsent data of each client and what to do with slow clients, must be called before Start()
+	void setSendConfig(const CellSendConfig& config);
+
+	// choose how accepted clients are spread over child servers, must be called before Start()
+	void setBalancer(CellBalancerType type);
+
+	// move busy clients away from a child server whose message rate stays far above average,
+	// not supported by io_uring engine, must be called before Start()
+	void setRebalance(bool enable);
+
+	// pin child server n to cpus[n % cpus.size()] and handler workers to the cpus after those of child servers,
+	// empty to leave threads to scheduler, must be called before Start()
+	void setCpuAffinity(const std::vector<int>& cpus);
+
+	// pin child servers and workers to cpus of a numa node, return false when node is unknown, must be called before Start()
+	bool setNumaNode(int node);
+
+	// pin child servers and workers to cpus of the numa node network interface is attached to, so packets, threads and
+	// their buffers stay on one socket, return false when node is unknown, must be called before Start()
+	bool setNicAffinity(const char* ifname);
+
+	// run OnNetMsg on a pool of nThreads workers instead of I/O threads, 0 to disable, must be called before Start()
+	void setWorkerThreads(int nThreads);
+
 	 // start child server to process client message
 	void Start(int childCount);
 
@@ -55,23 +110,45 @@ public:
 	// calculate number of packages/messages received per second
 	void recvMsgRate();
 
-	// send message to client
-	int sendMessage(SOCKET cSock, DataHeader* header);
+	// send message to client of id from any thread, message is copied and queued to the client,
+	// its child server sends it without blocking caller. return SOCKET_ERROR when client has exited
+	// or message is dropped by send budget
+	int sendMessage(unsigned long long id, const DataHeader* header);
+
+	// broadcast message to all users in server, message is copied into a pool block once and
+	// shared by all child servers, which queue it to their clients without blocking caller
+	void broadcastMessage(const DataHeader* header);
 
-	// broadcast message to all users in server
-	void broadcastMessage(DataHeader* header);
+	void broadcastMessage(const MsgBuf& msg);
+
+	// connected client of id, nullptr when it has exited, called by any thread
+	ClientPtr findClient(unsigned long long id);
+
+	// copy of all connected clients, called by any thread
+	void getClients(std::vector<ClientPtr>& clients);
 
 	// increase number of received packages
-	virtual void OnNetMsg(ChildServer* pChildServer, ClientPtr& clientSock, DataHeaderPtr header) override;
+	virtual void OnNetMsg(ChildServer* pChildServer, ClientPtr& clientSock, const MessageView& msg) override;
 
 	virtual void OnNetRecv(ClientPtr& clientSock) override;
 
+	// messages are only counted, cheap enough to be handled on I/O thread
+	virtual bool isInlineMsg(ChildServer* pChildServer, ClientPtr& clientSock, const MessageView& msg) override;
+
 	// new client connect server
 	virtual void OnJoin(ClientPtr& clientSock) override;
 
 	// delete the socket of exited client
 	virtual void OnExit(ClientPtr& clientSock) override;
 
+	// count clients which do not read their data fast enough
+	virtual void OnWriteBlocked(ChildServer* pChildServer, ClientPtr& clientSock) override;
+
+	virtual void OnWriteDrained(ChildServer* pChildServer, ClientPtr& clientSock) override;
+
+	// count clients moved between child servers
+	virtual void OnMigrate(ChildServer* pFrom, ChildServer* pTo, ClientPtr& clientSock) override;
+
 	friend void cmdThread(EasyTcpServer& Server);
 
 	virtual ~EasyTcpServer();
@@ -86,8 +163,18 @@ protected:
 	// number of received messages
 	std::atomic<int> _msgCount;
 
-	// all client sockets connected with server, this clients list can be used for message broadcast
-	std::vector<ClientPtr> _clients_list;
+	// number of clients whose unsent data is above high watermark
+	std::atomic<int> _blockedCount;
+
+	// number of clients moved between child servers since start
+	std::atomic<int> _migrateCount;
+
+	// number of accepted connections and wakeups of listening socket, to see how many accepts are batched
+	int _acceptCount;
+	int _acceptWakeups;
+
+	// all clients connected with server by connection id, they join and exit on child server threads as well
+	CellClientRegistry _clients;
 
 
 private:
@@ -96,12 +183,68 @@ private:
 	// server socket
 	SOCKET _sock;
 
+	// workers shared by all child servers, declared first so that it outlives them
+	std::unique_ptr<CellExecutor> _executor;
+
+	// number of worker threads running handlers, 0 when handlers run on I/O threads
+	int _workerThreads;
+
+	// cpus child servers are pinned to, empty when they are not pinned
+	std::vector<int> _cpus;
+
 	// child server to process client messages
 	std::vector<ChildServerPtr> _child_servers;
 
+	// chooses child server of each accepted client, load of children is printed with it
+	CellBalancerPtr _balancer;
+
+	// ask busiest child server to hand clients to idlest one when imbalance lasts, called after load is sampled
+	void rebalance();
+
+	bool _rebalance;
+
+	// number of stats windows in a row in which load has been imbalanced
+	int _imbalanceWindows;
+
+	// readiness backend used by child servers
+	CellPollerType _pollerType;
+
+	// limits of unsent data passed to child servers
+	CellSendConfig _sendConfig;
+	// I/O engine used by main server and child servers
+	CellIoEngine _ioEngine;
+
+	// create one more listening socket bound to the same address as server socket
+	SOCKET createReusePortSock();
+
+	// child servers accept connections themselves
+	bool _reusePort;
+
+	// maximum number of connections accepted in one wakeup
+	int _acceptBatch;
+
+	// address and backlog of server socket, used to create listening sockets of child servers
+	std::string _ip;
+	unsigned short _port;
+	int _backlog;
+
+#ifdef CELL_HAS_IO_URING
+	// accept connections with multishot accept
+	bool acceptUring();
+
+	// ring of main server, nullptr when reactor engine is used
+	std::unique_ptr<CellUring> _uring;
+#endif
+
 	CELLTimestamp _time;
 };
 
 void cmdThread(EasyTcpServer& Server);
 
+// print counters of memory manager and object pools, so pools can be sized from real traffic
+void printMemoryStats();
+
+// print number of connections and the ones with most unsent data
+void printClients(EasyTcpServer& Server);
+
 #endif // !_EsayTcpServer_hpp
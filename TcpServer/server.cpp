@@ -2,12 +2,14 @@
 // Windows: g++ server.cpp -std=c++11 -o server -lws2_32
 // add -lws2_32 flag to link winsocket dependency
 // Unix-like: g++ server.cpp -std=c++11 -o server 
+// usage: server [uring] [epoll|epoll_lt|select] [reuseport] [drop|disconnect|pause] [workers=N] [balance=rr|p2c|conn|bytes|msgs] [rebalance] [cpus=LIST|numa=N|nic=IFNAME] [poolmax=MB]
 
 // TODO: accept command line argument to set up port number
 
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 
 #include "Alloc.hpp"
+#include "MemoryMgr.hpp"
 #include "TcpServer.hpp"
 #include "ObjectPool.hpp"
 #include "Client.hpp"
@@ -17,23 +19,24 @@
 class MySever : public EasyTcpServer {
 	public:
 		// increase number of received message
-		void OnNetMsg(ChildServer* pChildServer,ClientPtr& clientSock, DataHeaderPtr header) override {
-			EasyTcpServer::OnNetMsg(pChildServer,clientSock, header);
+		// msg points into receive buffer, call msg.retain() to keep it after returning
+		void OnNetMsg(ChildServer* pChildServer,ClientPtr& clientSock, const MessageView& msg) override {
+			EasyTcpServer::OnNetMsg(pChildServer,clientSock, msg);
 
-			switch (header->cmd) {
+			switch (msg.cmd()) {
 				case CMD_LOGIN: {
-					Login* login = (Login*)header.get();
+					const Login* login = msg.as<Login>();
 					//std::cout << "Received message from client: " << allCommands[login->cmd] << " message length: " << login->length << std::endl;
 					//std::cout << "User: " << login->userName << " Password: " << login->password << std::endl;
 
-					// TODO: when user keep sending message to server, server will crash if it try to response to client
-					// auto ret = std::make_shared<LoginRet>();
-					// pChildServer->addSendTask(clientSock, (DataHeaderPtr)ret);
+					// response is queued and sent by child server without blocking, a slow client only delays itself
+					MsgBuf ret = MsgBuf::create<LoginRet>();
+					pChildServer->addSendTask(clientSock, ret);
 
 					break;
 				}
 				case CMD_LOGOUT: {
-					Logout* logout = (Logout*)header.get();
+					const Logout* logout = msg.as<Logout>();
 					//std::cout << "Received message from client: " << allCommands[logout->cmd] << " message length: " << logout->length << std::endl;
 					//std::cout << "User: " << logout->userName << std::endl;
 					//// TODO: needs account validation
@@ -55,6 +58,11 @@ class MySever : public EasyTcpServer {
 			EasyTcpServer::OnNetRecv(clientSock);
 		}
 
+		// login may be validated against an account store later, so it is handled by worker threads
+		bool isInlineMsg(ChildServer* pChildServer, ClientPtr& clientSock, const MessageView& msg) override {
+			return msg.cmd() != CMD_LOGIN;
+		}
+
 		// new client connect server
 		void OnJoin(ClientPtr& clientSock) override {
 			EasyTcpServer::OnJoin(clientSock);
@@ -64,18 +72,60 @@ class MySever : public EasyTcpServer {
 		void OnExit(ClientPtr& clientSock) override {
 			EasyTcpServer::OnExit(clientSock);
 		}
+
+		// responses to a blocked client are dropped or delayed by its child server according to slow client policy
+		void OnWriteBlocked(ChildServer* pChildServer, ClientPtr& clientSock) override {
+			EasyTcpServer::OnWriteBlocked(pChildServer, clientSock);
+		}
+
+		void OnWriteDrained(ChildServer* pChildServer, ClientPtr& clientSock) override {
+			EasyTcpServer::OnWriteDrained(pChildServer, clientSock);
+		}
+
+		// client keeps its state, including a partly received message, when it moves to another child server
+		void OnMigrate(ChildServer* pFrom, ChildServer* pTo, ClientPtr& clientSock) override {
+			EasyTcpServer::OnMigrate(pFrom, pTo, clientSock);
+		}
 	private:
 };
 
-int main() {
+int main(int argc, char** argv) {
 
 	MySever server;
+	CellSendConfig sendConfig;
+
+	// choose I/O engine, poller and accept mode, so that they can be compared under the same load
+	for (int n = 1; n < argc; n++) {
+		if (strcmp(argv[n], "uring") == 0) server.setIoEngine(CellIoEngine::IoUring);
+		else if (strcmp(argv[n], "epoll") == 0) server.setPollerType(CellPollerType::Epoll);
+		else if (strcmp(argv[n], "epoll_lt") == 0) server.setPollerType(CellPollerType::EpollLT);
+		else if (strcmp(argv[n], "select") == 0) server.setPollerType(CellPollerType::Select);
+		else if (strcmp(argv[n], "reuseport") == 0) server.setReusePort(true);
+		else if (strcmp(argv[n], "drop") == 0) sendConfig.policy = CellSlowClientPolicy::Drop;
+		else if (strcmp(argv[n], "disconnect") == 0) sendConfig.policy = CellSlowClientPolicy::Disconnect;
+		else if (strcmp(argv[n], "pause") == 0) sendConfig.policy = CellSlowClientPolicy::PauseReads;
+		else if (strcmp(argv[n], "balance=rr") == 0) server.setBalancer(CellBalancerType::RoundRobin);
+		else if (strcmp(argv[n], "balance=p2c") == 0) server.setBalancer(CellBalancerType::PowerOfTwo);
+		else if (strcmp(argv[n], "balance=conn") == 0) server.setBalancer(CellBalancerType::LeastConnections);
+		else if (strcmp(argv[n], "balance=bytes") == 0) server.setBalancer(CellBalancerType::LeastBytes);
+		else if (strcmp(argv[n], "balance=msgs") == 0) server.setBalancer(CellBalancerType::LeastMessages);
+		else if (strcmp(argv[n], "rebalance") == 0) server.setRebalance(true);
+		else if (strncmp(argv[n], "cpus=", 5) == 0) server.setCpuAffinity(CellAffinity::parseCpuList(argv[n] + 5));
+		else if (strncmp(argv[n], "numa=", 5) == 0) server.setNumaNode(atoi(argv[n] + 5));
+		else if (strncmp(argv[n], "nic=", 4) == 0) server.setNicAffinity(argv[n] + 4);
+		else if (strncmp(argv[n], "workers=", 8) == 0) server.setWorkerThreads(atoi(argv[n] + 8));
+		else if (strncmp(argv[n], "poolmax=", 8) == 0) MemoryMgr::getInstance().setMaxPoolSize((size_t)atoi(argv[n] + 8) * 1024 * 1024);
+		else std::cout << "unknown option: " << argv[n] << std::endl;
+	}
+
+	server.setSendConfig(sendConfig);
 
     server.initSocket();
 
     server.bindPort(nullptr,4567);
 
-    server.listenNumber(5);
+    // a short queue of pending connections overflows when many clients reconnect at once
+    server.listenNumber(SOMAXCONN);
 	 
     server.Start(4);
 	